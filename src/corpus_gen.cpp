@@ -0,0 +1,196 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Deterministic corpus generator for benchmarking fdupes. The same
+ * options and seed always give the same tree, byte for byte: file
+ * contents are a function of a per-file seed and the offset only.
+ *
+ * Every file is one of
+ *   unique   a fresh size (log-uniform between the bounds) and content
+ *   copy     identical to an earlier unique file
+ *   header   the size and first half of an earlier unique file, then
+ *            content of its own: it survives the partial CRC and head
+ *            sample and is only told apart by a full read
+ */
+
+struct corpus_file {
+  off_t size;
+  uint64_t seed;          /* content seed */
+  uint64_t header_seed;   /* seed of the first half, if shared */
+};
+
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/* Uniform in [0, 1), the same everywhere, as the std:: distributions are not. */
+static double unit(std::mt19937_64 &generator) {
+  return (generator() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Content of a file with the given seed at offset, a word at a time. */
+static void fill(uint64_t seed, off_t offset, unsigned char *buffer, size_t length) {
+  for(size_t i=0; i<length; ) {
+    off_t word = (offset + i) / 8;
+    uint64_t value = splitmix64(seed ^ splitmix64(word));
+    for(size_t byte=(offset + i) % 8; byte<8 && i<length; byte++, i++) {
+      buffer[i] = (unsigned char)(value >> (byte * 8));
+    }
+  }
+}
+
+static bool write_file(const std::string &path, const corpus_file &file) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd<0) return false;
+  static unsigned char buffer[64*1024];
+  off_t header = file.header_seed ? file.size / 2 : 0;
+  bool ok = true;
+  for(off_t offset=0; offset<file.size && ok; ) {
+    size_t length = (size_t)std::min((off_t)sizeof(buffer), file.size - offset);
+    /* never straddle the end of a shared header */
+    if(offset<header) length = (size_t)std::min((off_t)length, header - offset);
+    fill(offset<header ? file.header_seed : file.seed, offset, buffer, length);
+    ok = write(fd, buffer, length)==(ssize_t)length;
+    offset += length;
+  }
+  return close(fd)==0 && ok;
+}
+
+static void help_text(const char *program) {
+  printf("Usage: %s [options] DIRECTORY\n\n", program);
+  printf(" -n N\tnumber of files (default 10000)\n");
+  printf(" -s min:max\tfile sizes, log-uniform between min and max\n");
+  printf("   \tbytes (default 1:1048576)\n");
+  printf(" -c ratio\tfraction of files that copy an earlier one\n");
+  printf("   \t(default 0.2)\n");
+  printf(" -H ratio\tfraction of files sharing size and first half\n");
+  printf("   \twith an earlier one (default 0.1)\n");
+  printf(" -d depth\tdirectory levels below DIRECTORY (default 3)\n");
+  printf(" -w N\tsubdirectories per directory (default 4)\n");
+  printf(" -S seed\tseed for sizes, placement and contents (default 1)\n");
+  printf(" -h\tdisplay this help message\n\n");
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = 10000;
+  double min_size = 1, max_size = 1024*1024;
+  double copy_ratio = 0.2, header_ratio = 0.1;
+  unsigned int depth = 3, width = 4;
+  uint64_t seed = 1;
+
+  int opt;
+  while((opt = getopt(argc, argv, "n:s:c:H:d:w:S:h")) != EOF) {
+    switch(opt) {
+      case 'n':
+        count = strtoull(optarg, NULL, 0);
+        break;
+      case 's':
+        if(sscanf(optarg, "%lf:%lf", &min_size, &max_size)!=2 || min_size<0 || max_size<min_size) {
+          fprintf(stderr, "%s: bad size range '%s'\n", argv[0], optarg);
+          exit(1);
+        }
+        break;
+      case 'c':
+        copy_ratio = atof(optarg);
+        break;
+      case 'H':
+        header_ratio = atof(optarg);
+        break;
+      case 'd':
+        depth = atoi(optarg);
+        break;
+      case 'w':
+        width = atoi(optarg)>0 ? atoi(optarg) : 1;
+        break;
+      case 'S':
+        seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'h':
+        help_text(argv[0]);
+        exit(0);
+      default:
+        fprintf(stderr, "Try `%s --help' for more information\n", argv[0]);
+        exit(1);
+    }
+  }
+  if(optind != argc-1 || copy_ratio<0 || header_ratio<0 || copy_ratio+header_ratio>1) {
+    help_text(argv[0]);
+    exit(1);
+  }
+  std::string root = argv[optind];
+
+  /* directories breadth first; children of directories[i] follow */
+  std::vector<std::string> directories(1, root);
+  for(size_t first=0, level=0; level<depth; level++) {
+    size_t last = directories.size();
+    for(size_t i=first; i<last; i++) {
+      for(unsigned int w=0; w<width; w++) {
+        directories.push_back(directories[i] + "/d" + std::to_string(w));
+      }
+    }
+    first = last;
+  }
+  for(auto it=directories.begin(); it!=directories.end(); ++it) {
+    if(mkdir(it->c_str(), 0755)!=0 && errno!=EEXIST) {
+      fprintf(stderr, "%s: could not create %s: %s\n", argv[0], it->c_str(), strerror(errno));
+      exit(1);
+    }
+  }
+
+  std::mt19937_64 generator(seed);
+  double log_min = std::log(min_size + 1), log_max = std::log(max_size + 1);
+  std::vector<corpus_file> unique;
+  size_t copies = 0, headers = 0;
+  uint64_t bytes = 0;
+  for(size_t i=0; i<count; i++) {
+    double kind = unit(generator);
+    corpus_file file;
+    file.header_seed = 0;
+    if(!unique.empty() && kind<copy_ratio) {
+      file = unique[generator() % unique.size()];
+      copies++;
+    } else if(!unique.empty() && kind<copy_ratio+header_ratio) {
+      const corpus_file &base = unique[generator() % unique.size()];
+      file.size = base.size;
+      file.seed = splitmix64(seed ^ (i << 1 | 1));
+      file.header_seed = base.seed;
+      headers++;
+    } else {
+      file.size = (off_t)(std::exp(log_min + unit(generator) * (log_max - log_min)) - 1);
+      file.seed = splitmix64(seed ^ (i << 1));
+      unique.push_back(file);
+    }
+
+    std::string path = directories[generator() % directories.size()] + "/f" + std::to_string(i);
+    if(!write_file(path, file)) {
+      fprintf(stderr, "%s: could not write %s: %s\n", argv[0], path.c_str(), strerror(errno));
+      exit(1);
+    }
+    bytes += file.size;
+  }
+
+  printf("%zu files in %zu directories, %.1f megabytes: %zu copies, %zu with a shared header\n",
+      count, directories.size(), bytes / (1024.0 * 1024.0), copies, headers);
+  return 0;
+}
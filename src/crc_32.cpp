@@ -1,5 +1,15 @@
 #include "crc_32.h"
 
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define CRC32_X86_SIMD
+# include <immintrin.h>
+#endif
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+# define CRC32_SLICING
+#endif
+
 /*-
  *  COPYRIGHT (C) 1986 Gary S. Brown.  You may use this program, or
  *  code or tables extracted from it, as desired without restriction.
@@ -88,7 +98,7 @@ static uint32_t crc32_tab[] = {
   0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t crc32(uint32_t crc, const void *buf, size_t size) {
+static uint32_t crc32_table(uint32_t crc, const void *buf, size_t size) {
   const uint8_t *p = (const uint8_t *)buf;
 
   crc = crc ^ ~0U;
@@ -100,3 +110,385 @@ uint32_t crc32(uint32_t crc, const void *buf, size_t size) {
   return crc ^ ~0U;
 }
 
+#ifdef CRC32_SLICING
+/*
+ *  Slicing-by-N: table k holds the CRC of a byte followed by k zero
+ *  bytes, so N input bytes can be folded in with N independent lookups
+ *  instead of a chain of N dependent ones.
+ */
+struct crc32_slice_tables {
+  uint32_t t[16][256];
+
+  crc32_slice_tables() {
+    for (int i = 0; i < 256; i++) {
+      t[0][i] = crc32_tab[i];
+    }
+    for (int k = 1; k < 16; k++) {
+      for (int i = 0; i < 256; i++) {
+        t[k][i] = (t[k-1][i] >> 8) ^ crc32_tab[t[k-1][i] & 0xFF];
+      }
+    }
+  }
+};
+
+static const crc32_slice_tables &slice_tables() {
+  static const crc32_slice_tables tables;
+  return tables;
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const void *buf, size_t size) {
+  const uint32_t (*t)[256] = slice_tables().t;
+  const uint8_t *p = (const uint8_t *)buf;
+
+  crc = crc ^ ~0U;
+
+  while (size >= 8) {
+    uint32_t one = load32(p) ^ crc;
+    uint32_t two = load32(p + 4);
+    crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+          t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    p += 8;
+    size -= 8;
+  }
+  while (size--) {
+    crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+
+  return crc ^ ~0U;
+}
+
+static uint32_t crc32_slice16(uint32_t crc, const void *buf, size_t size) {
+  const uint32_t (*t)[256] = slice_tables().t;
+  const uint8_t *p = (const uint8_t *)buf;
+
+  crc = crc ^ ~0U;
+
+  while (size >= 16) {
+    uint32_t one = load32(p) ^ crc;
+    uint32_t two = load32(p + 4);
+    uint32_t three = load32(p + 8);
+    uint32_t four = load32(p + 12);
+    crc = t[15][one & 0xFF] ^ t[14][(one >> 8) & 0xFF] ^ t[13][(one >> 16) & 0xFF] ^ t[12][one >> 24] ^
+          t[11][two & 0xFF] ^ t[10][(two >> 8) & 0xFF] ^ t[9][(two >> 16) & 0xFF] ^ t[8][two >> 24] ^
+          t[7][three & 0xFF] ^ t[6][(three >> 8) & 0xFF] ^ t[5][(three >> 16) & 0xFF] ^ t[4][three >> 24] ^
+          t[3][four & 0xFF] ^ t[2][(four >> 8) & 0xFF] ^ t[1][(four >> 16) & 0xFF] ^ t[0][four >> 24];
+    p += 16;
+    size -= 16;
+  }
+  while (size--) {
+    crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+
+  return crc ^ ~0U;
+}
+#endif//CRC32_SLICING
+
+#ifdef CRC32_X86_SIMD
+/*
+ *  Carry-less multiplication folding, after Gopal et al., "Fast CRC
+ *  Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ *  (Intel, 2009). Constants are x^(D+32) and x^(D-32) mod P, bit
+ *  reflected and shifted left by one, for a folding distance of D bits.
+ */
+static const uint64_t k_fold512[2] = { 0x0154442bd4ULL, 0x01c6e41596ULL };   /* D = 4x128 */
+static const uint64_t k_fold128[2] = { 0x01751997d0ULL, 0x00ccaa009eULL };   /* D = 128 */
+static const uint64_t k_fold64 = 0x0163cd6124ULL;
+static const uint64_t k_barrett[2] = { 0x01db710641ULL, 0x01f7011641ULL };   /* P', mu */
+static const uint64_t k_fold2048[2] = { 0x011542778aULL, 0x01322d1430ULL };  /* D = 4x512 */
+
+/* Fold four accumulated 128-bit lanes and any remaining 16-byte blocks
+ * down to the 32-bit CRC. len must be a multiple of 16. */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_finish(__m128i x1, __m128i x2, __m128i x3, __m128i x4, const uint8_t *p, size_t len) {
+  __m128i x0, x5;
+
+  x0 = _mm_set_epi64x(k_fold128[1], k_fold128[0]);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  while (len >= 16) {
+    x2 = _mm_loadu_si128((const __m128i *)p);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    p += 16;
+    len -= 16;
+  }
+
+  /* 128 bits down to 64 */
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+
+  x0 = _mm_set_epi64x(0, k_fold64);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /* Barrett reduction to 32 bits */
+  x0 = _mm_set_epi64x(k_barrett[1], k_barrett[0]);
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return _mm_extract_epi32(x1, 1);
+}
+
+/* len >= 64 and a multiple of 16; crc is the running (inverted) state. */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_fold(uint32_t crc, const uint8_t *p, size_t len) {
+  const __m128i k = _mm_set_epi64x(k_fold512[1], k_fold512[0]);
+  __m128i x1, x2, x3, x4;
+
+  x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  p += 64;
+  len -= 64;
+
+  while (len >= 64) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(p + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(p + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(p + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(p + 0x30)));
+    p += 64;
+    len -= 64;
+  }
+
+  return crc32_fold_finish(x1, x2, x3, x4, p, len);
+}
+
+/* Same folding, four 512-bit lanes (256 bytes) per step. len >= 256
+ * and a multiple of 16. */
+__attribute__((target("avx512f,avx512vl,vpclmulqdq,pclmul,sse4.1")))
+static uint32_t crc32_vpclmul_fold(uint32_t crc, const uint8_t *p, size_t len) {
+  const __m512i k256 = _mm512_set_epi64(k_fold2048[1], k_fold2048[0], k_fold2048[1], k_fold2048[0],
+                                        k_fold2048[1], k_fold2048[0], k_fold2048[1], k_fold2048[0]);
+  const __m512i k64 = _mm512_set_epi64(k_fold512[1], k_fold512[0], k_fold512[1], k_fold512[0],
+                                       k_fold512[1], k_fold512[0], k_fold512[1], k_fold512[0]);
+  __m512i x1, x2, x3, x4;
+
+  x1 = _mm512_loadu_si512((const void *)(p + 0x00));
+  x2 = _mm512_loadu_si512((const void *)(p + 0x40));
+  x3 = _mm512_loadu_si512((const void *)(p + 0x80));
+  x4 = _mm512_loadu_si512((const void *)(p + 0xc0));
+  x1 = _mm512_xor_si512(x1, _mm512_inserti32x4(_mm512_setzero_si512(), _mm_cvtsi32_si128(crc), 0));
+  p += 256;
+  len -= 256;
+
+#define CRC32_FOLD512(x, k, y) \
+  _mm512_xor_si512(_mm512_xor_si512(_mm512_clmulepi64_epi128(x, k, 0x00), _mm512_clmulepi64_epi128(x, k, 0x11)), y)
+
+  while (len >= 256) {
+    x1 = CRC32_FOLD512(x1, k256, _mm512_loadu_si512((const void *)(p + 0x00)));
+    x2 = CRC32_FOLD512(x2, k256, _mm512_loadu_si512((const void *)(p + 0x40)));
+    x3 = CRC32_FOLD512(x3, k256, _mm512_loadu_si512((const void *)(p + 0x80)));
+    x4 = CRC32_FOLD512(x4, k256, _mm512_loadu_si512((const void *)(p + 0xc0)));
+    p += 256;
+    len -= 256;
+  }
+
+  /* Four lanes into one, then whole 64-byte blocks. */
+  x1 = CRC32_FOLD512(x1, k64, x2);
+  x1 = CRC32_FOLD512(x1, k64, x3);
+  x1 = CRC32_FOLD512(x1, k64, x4);
+  while (len >= 64) {
+    x1 = CRC32_FOLD512(x1, k64, _mm512_loadu_si512((const void *)p));
+    p += 64;
+    len -= 64;
+  }
+#undef CRC32_FOLD512
+
+  __m128i lanes[4];
+  _mm512_storeu_si512((void *)lanes, x1);
+  return crc32_fold_finish(lanes[0], lanes[1], lanes[2], lanes[3], p, len);
+}
+
+/* Remainders shorter than a 16-byte block go through the best scalar kernel. */
+static uint32_t crc32_tail(uint32_t crc, const uint8_t *p, size_t size) {
+#ifdef CRC32_SLICING
+  return crc32_slice8(crc, p, size);
+#else
+  return crc32_table(crc, p, size);
+#endif
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const void *buf, size_t size) {
+  const uint8_t *p = (const uint8_t *)buf;
+
+  if (size >= 64) {
+    size_t chunk = size & ~(size_t)15;
+    crc = ~crc32_pclmul_fold(~crc, p, chunk);
+    p += chunk;
+    size -= chunk;
+  }
+  return crc32_tail(crc, p, size);
+}
+
+/* Below this the 512-bit setup costs more than it saves. */
+#define CRC32_VPCLMUL_MIN_SIZE 2048
+
+static uint32_t crc32_vpclmul(uint32_t crc, const void *buf, size_t size) {
+  const uint8_t *p = (const uint8_t *)buf;
+
+  if (size >= CRC32_VPCLMUL_MIN_SIZE) {
+    size_t chunk = size & ~(size_t)15;
+    crc = ~crc32_vpclmul_fold(~crc, p, chunk);
+    p += chunk;
+    size -= chunk;
+  }
+  return crc32_pclmul(crc, p, size);
+}
+#endif//CRC32_X86_SIMD
+
+const char *crc32_kernel_name(crc32_kernel kernel) {
+  switch (kernel) {
+    case CRC32_TABLE: return "table";
+    case CRC32_SLICE8: return "slice-by-8";
+    case CRC32_SLICE16: return "slice-by-16";
+    case CRC32_PCLMUL: return "pclmulqdq";
+    case CRC32_VPCLMUL: return "vpclmulqdq";
+    default: return "unknown";
+  }
+}
+
+bool crc32_kernel_supported(crc32_kernel kernel) {
+  switch (kernel) {
+    case CRC32_TABLE:
+      return true;
+#ifdef CRC32_SLICING
+    case CRC32_SLICE8:
+    case CRC32_SLICE16:
+      return true;
+#endif
+#ifdef CRC32_X86_SIMD
+    case CRC32_PCLMUL:
+      return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    case CRC32_VPCLMUL:
+      return crc32_kernel_supported(CRC32_PCLMUL) && __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("vpclmulqdq");
+#endif
+    default:
+      return false;
+  }
+}
+
+crc32_function crc32_kernel_function(crc32_kernel kernel) {
+  if (!crc32_kernel_supported(kernel)) return NULL;
+  switch (kernel) {
+    case CRC32_TABLE: return crc32_table;
+#ifdef CRC32_SLICING
+    case CRC32_SLICE8: return crc32_slice8;
+    case CRC32_SLICE16: return crc32_slice16;
+#endif
+#ifdef CRC32_X86_SIMD
+    case CRC32_PCLMUL: return crc32_pclmul;
+    case CRC32_VPCLMUL: return crc32_vpclmul;
+#endif
+    default: return NULL;
+  }
+}
+
+/* Bytes the kernels are checked over before one is chosen. */
+#define CRC32_CHECK_SIZE 4608
+
+/*
+ *  Pick the fastest supported kernel that agrees with the reference
+ *  table on a buffer exercising every block size and tail length.
+ */
+static crc32_kernel crc32_select() {
+  static const crc32_kernel preference[] = { CRC32_VPCLMUL, CRC32_PCLMUL, CRC32_SLICE16, CRC32_SLICE8 };
+  /* past CRC32_VPCLMUL_MIN_SIZE twice over, so every fold is exercised */
+  static uint8_t sample[CRC32_CHECK_SIZE + 64];
+  for (size_t i = 0; i < sizeof(sample); i++) {
+    sample[i] = (uint8_t)(i * 131 + (i >> 3));
+  }
+  for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+    crc32_function fn = crc32_kernel_function(preference[i]);
+    if (fn == NULL) continue;
+    bool ok = true;
+    for (size_t len = 0; ok && len <= CRC32_CHECK_SIZE; len += (len < 320 ? 1 : 61)) {
+      ok = fn(0x12345678, sample + (len & 15), len) == crc32_table(0x12345678, sample + (len & 15), len);
+    }
+    if (ok) return preference[i];
+  }
+  return CRC32_TABLE;
+}
+
+crc32_kernel crc32_active_kernel() {
+  static const crc32_kernel kernel = crc32_select();
+  return kernel;
+}
+
+uint32_t crc32(uint32_t crc, const void *buf, size_t size) {
+  static const crc32_function fn = crc32_kernel_function(crc32_active_kernel());
+  return fn(crc, buf, size);
+}
+
+/*
+ * Zero bytes only shift the register, each multiplying it by x^8
+ * modulo the polynomial; a run of them is done in one multiplication by
+ * x^(8*size), built from x^(2^k) by squaring.
+ */
+#define CRC32_POLY 0xedb88320U
+
+/* a*b modulo the polynomial, bit reflected */
+static uint32_t multiply_mod(uint32_t a, uint32_t b) {
+  uint32_t product = 0;
+  for(uint32_t m=1U<<31; m; m>>=1) {
+    if(a & m) product ^= b;
+    b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+  }
+  return product;
+}
+
+uint32_t crc32_zeros(uint32_t crc, uint64_t size) {
+  static uint32_t powers[67];   /* x^(2^k), for all of a 64 bit size */
+  static bool initialised = [] {
+    powers[0] = 1U<<30;   /* x^1 */
+    for(int k=1; k<67; k++) {
+      powers[k] = multiply_mod(powers[k-1], powers[k-1]);
+    }
+    return true;
+  }();
+  (void)initialised;
+
+  /* x^(8*size), from the bits of size shifted by three */
+  uint32_t power = 1U<<31;   /* x^0 */
+  for(int k=3; size; size>>=1, k++) {
+    if(size & 1) power = multiply_mod(powers[k], power);
+  }
+  return ~multiply_mod(power, ~crc);
+}
@@ -4,6 +4,27 @@
 #include <cstdlib>
 #include <cstdint>
 
+/* CRC-32 (IEEE 802.3, reflected 0xedb88320) using the fastest kernel
+ * this CPU supports; chosen on first use. */
 uint32_t crc32(uint32_t crc, const void *buf, size_t size);
+/* crc32() over size zero bytes, without looking at any. */
+uint32_t crc32_zeros(uint32_t crc, uint64_t size);
+
+enum crc32_kernel {
+  CRC32_TABLE,      /* byte at a time, the reference implementation */
+  CRC32_SLICE8,
+  CRC32_SLICE16,
+  CRC32_PCLMUL,     /* SSE4.1 + PCLMULQDQ folding */
+  CRC32_VPCLMUL,    /* AVX-512 + VPCLMULQDQ folding */
+  CRC32_KERNELS
+};
+
+typedef uint32_t (*crc32_function)(uint32_t crc, const void *buf, size_t size);
+
+const char *crc32_kernel_name(crc32_kernel kernel);
+bool crc32_kernel_supported(crc32_kernel kernel);
+/* NULL if the kernel was not compiled in or the CPU lacks support. */
+crc32_function crc32_kernel_function(crc32_kernel kernel);
+crc32_kernel crc32_active_kernel();
 
 #endif//CRC_32_H
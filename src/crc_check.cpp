@@ -0,0 +1,91 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "crc_32.h"
+
+/*
+ * Checks every kernel this CPU supports against the reference table, at
+ * every length up to well past the widest kernel's threshold and at
+ * every alignment, and crc32_zeros() against crc32() over zero bytes.
+ */
+
+#define CHECK_SIZE 16384
+
+/* reference CRCs of every prefix of data from offset, a byte at a time */
+static void prefixes(crc32_function reference, uint32_t seed, const std::vector<unsigned char> &data, size_t offset,
+                     std::vector<uint32_t> &crcs) {
+  crcs.resize(CHECK_SIZE + 1);
+  crcs[0] = seed;
+  for (size_t len = 0; len < CHECK_SIZE; len++) {
+    crcs[len + 1] = reference(crcs[len], &data[offset + len], 1);
+  }
+}
+
+static int check_kernel(crc32_kernel kernel, crc32_function fn, crc32_function reference,
+                        const std::vector<unsigned char> &data) {
+  const uint32_t seeds[] = { 0, 0x12345678 };
+  std::vector<uint32_t> expect;
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t s = 0; s < sizeof(seeds) / sizeof(seeds[0]); s++) {
+      prefixes(reference, seeds[s], data, offset, expect);
+      /* every alignment up to 4K, a few past it */
+      size_t last = (offset == 0 || offset == 1 || offset == 7) ? CHECK_SIZE : 4096;
+      for (size_t len = 0; len <= last; len++) {
+        uint32_t got = fn(seeds[s], &data[offset], len);
+        if (got != expect[len]) {
+          fprintf(stderr, "%s: length %zu, offset %zu, crc %08x: got %08x, expected %08x\n",
+                  crc32_kernel_name(kernel), len, offset, seeds[s], got, expect[len]);
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static int check_zeros(crc32_function reference) {
+  std::vector<unsigned char> zeros(CHECK_SIZE);
+  for (size_t len = 0; len <= CHECK_SIZE; len += (len < 1024 ? 1 : 97)) {
+    uint32_t expect = reference(0x12345678, zeros.data(), len);
+    uint32_t got = crc32_zeros(0x12345678, len);
+    if (got != expect) {
+      fprintf(stderr, "crc32_zeros: length %zu: got %08x, expected %08x\n", len, got, expect);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int, char *[]) {
+  std::vector<unsigned char> data(CHECK_SIZE + 64);
+  srand(42);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() & 0xFF;
+  }
+
+  crc32_function reference = crc32_kernel_function(CRC32_TABLE);
+  int failures = 0;
+  for (int k = CRC32_TABLE + 1; k < CRC32_KERNELS; k++) {
+    crc32_kernel kernel = (crc32_kernel)k;
+    crc32_function fn = crc32_kernel_function(kernel);
+    if (fn == NULL) {
+      printf("%-12s unsupported\n", crc32_kernel_name(kernel));
+      continue;
+    }
+    int failed = check_kernel(kernel, fn, reference, data);
+    printf("%-12s %s\n", crc32_kernel_name(kernel), failed ? "WRONG" : "ok");
+    failures += failed;
+  }
+  failures += check_zeros(reference);
+  if (crc32(0, data.data(), data.size()) != reference(0, data.data(), data.size())) {
+    fprintf(stderr, "crc32: active kernel %s disagrees\n", crc32_kernel_name(crc32_active_kernel()));
+    failures++;
+  }
+
+  return failures == 0 ? 0 : 1;
+}
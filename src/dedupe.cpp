@@ -0,0 +1,97 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "dedupe.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#if defined(HAVE_LINUX_FS_H) && defined(__linux__)
+# include <linux/fs.h>
+#endif
+
+#ifdef FIDEDUPERANGE
+/* EINVAL is not among these: it comes from filesystems that do share
+ * extents but refused this range or these files. */
+static bool unsupported(int error) {
+  return error==EOPNOTSUPP || error==ENOTTY || error==EXDEV;
+}
+
+dedupe_result dedupe_range(const std::string &source, const std::string &target, off_t size) {
+  int src = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if(src<0) return DEDUPE_FAILED;
+  /* owners may dedupe into files they only have open for reading */
+  int dst = open(target.c_str(), O_RDWR | O_CLOEXEC);
+  if(dst<0 && (errno==EACCES || errno==ETXTBSY || errno==EROFS)) dst = open(target.c_str(), O_RDONLY | O_CLOEXEC);
+  if(dst<0) {
+    int error = errno;
+    close(src);
+    errno = error;
+    return DEDUPE_FAILED;
+  }
+
+  union {
+    struct file_dedupe_range range;
+    char buffer[sizeof(struct file_dedupe_range) + sizeof(struct file_dedupe_range_info)];
+  } request;
+  dedupe_result result = DEDUPE_SHARED;
+  int error = 0;
+  for(off_t offset=0; offset<size; ) {
+    memset(&request, 0, sizeof(request));
+    request.range.src_offset = offset;
+    request.range.src_length = std::min(DEDUPE_CHUNK, size-offset);
+    request.range.dest_count = 1;
+    request.range.info[0].dest_fd = dst;
+    request.range.info[0].dest_offset = offset;
+
+    const struct file_dedupe_range_info &info = request.range.info[0];
+    if(ioctl(src, FIDEDUPERANGE, &request.range) < 0) {
+      error = errno;
+    } else if(info.status==FILE_DEDUPE_RANGE_DIFFERS) {
+      result = DEDUPE_DIFFERS;
+      break;
+    } else if(info.status < 0) {
+      error = -info.status;
+    } else if(info.bytes_deduped==0) {
+      error = EIO;
+    }
+    if(error) {
+      result = unsupported(error) ? DEDUPE_UNSUPPORTED : DEDUPE_FAILED;
+      break;
+    }
+    offset += info.bytes_deduped;
+  }
+
+  close(dst);
+  close(src);
+  errno = error;
+  return result;
+}
+#else
+dedupe_result dedupe_range(const std::string &source, const std::string &target, off_t size) {
+  (void)source;
+  (void)target;
+  (void)size;
+  errno = EOPNOTSUPP;
+  return DEDUPE_UNSUPPORTED;
+}
+#endif
+
+bool replace_with_link(const std::string &source, const std::string &target) {
+  std::string temporary = target + ".fdupes-link";
+  if(link(source.c_str(), temporary.c_str()) != 0) return false;
+  if(rename(temporary.c_str(), target.c_str()) != 0) {
+    int error = errno;
+    unlink(temporary.c_str());
+    errno = error;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+#include <string>
+
+#include <sys/types.h>
+
+/* Bytes handed to FIDEDUPERANGE per call; filesystems cap it anyway. */
+#define DEDUPE_CHUNK (off_t)(16*1024*1024)
+
+enum dedupe_result {
+  DEDUPE_SHARED,       /* target now shares the source's extents */
+  DEDUPE_DIFFERS,      /* the kernel found the contents differ */
+  DEDUPE_UNSUPPORTED,  /* the filesystem cannot share extents */
+  DEDUPE_FAILED        /* anything else; errno is set */
+};
+
+/*
+ * Make the first size bytes of target share the source's extents with
+ * FIDEDUPERANGE. The kernel locks both files and compares them itself,
+ * so this is safe even if either changed since it was last read.
+ */
+dedupe_result dedupe_range(const std::string &source, const std::string &target, off_t size);
+
+/*
+ * Atomically replace target with a hard link to source, through a
+ * temporary link beside target and rename(). False with errno set.
+ */
+bool replace_with_link(const std::string &source, const std::string &target);
+
+#endif//DEDUPE_H
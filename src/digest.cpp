@@ -0,0 +1,42 @@
+#include "digest.h"
+
+#include <openssl/evp.h>
+
+static const char *kind_names[DIGEST_KINDS] = { "crc32", "sha256", "blake2b" };
+
+digest_context::digest_context(digest_kind kind)
+  : m_ctx(EVP_MD_CTX_new())
+{
+  const EVP_MD *md = (kind==DIGEST_BLAKE2B) ? EVP_blake2b512() : EVP_sha256();
+  EVP_DigestInit_ex((EVP_MD_CTX *)m_ctx, md, NULL);
+}
+
+digest_context::~digest_context() {
+  EVP_MD_CTX_free((EVP_MD_CTX *)m_ctx);
+}
+
+void digest_context::update(const void *data, size_t length) {
+  EVP_DigestUpdate((EVP_MD_CTX *)m_ctx, data, length);
+}
+
+void digest_context::final(digest_t &digest) {
+  unsigned char full[EVP_MAX_MD_SIZE];
+  unsigned int length = 0;
+  EVP_DigestFinal_ex((EVP_MD_CTX *)m_ctx, full, &length);
+  memset(digest.bytes, 0, DIGEST_SIZE);
+  memcpy(digest.bytes, full, length < DIGEST_SIZE ? length : DIGEST_SIZE);
+}
+
+const char *digest_context::kind_name(digest_kind kind) {
+  return kind < DIGEST_KINDS ? kind_names[kind] : "unknown";
+}
+
+bool digest_context::parse_kind(const std::string &name, digest_kind &kind) {
+  for(int i=0; i<DIGEST_KINDS; i++) {
+    if(name==kind_names[i]) {
+      kind = (digest_kind)i;
+      return true;
+    }
+  }
+  return false;
+}
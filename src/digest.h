@@ -0,0 +1,50 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/* Bytes kept of every digest: 256 bits. */
+#define DIGEST_SIZE 32
+
+enum digest_kind {
+  DIGEST_NONE,     /* CRC32 only, confirmed by byte comparison */
+  DIGEST_SHA256,   /* SHA-256, using the CPU's SHA extensions where present */
+  DIGEST_BLAKE2B,  /* BLAKE2b-512, truncated */
+  DIGEST_KINDS
+};
+
+struct digest_t {
+  unsigned char bytes[DIGEST_SIZE];
+
+  bool operator==(const digest_t &other) const {
+    return memcmp(bytes, other.bytes, DIGEST_SIZE)==0;
+  }
+  bool operator<(const digest_t &other) const {
+    return memcmp(bytes, other.bytes, DIGEST_SIZE)<0;
+  }
+};
+
+/*
+ * Streaming cryptographic digest, computed by libcrypto. Unlike CRC32,
+ * equal digests of equal-sized files are taken as proof that the
+ * contents are equal.
+ */
+class digest_context {
+  public:
+    explicit digest_context(digest_kind kind);
+    digest_context(const digest_context &)=delete;
+    digest_context &operator=(const digest_context &)=delete;
+    ~digest_context();
+
+    void update(const void *data, size_t length);
+    void final(digest_t &digest);
+
+    static const char *kind_name(digest_kind kind);
+    static bool parse_kind(const std::string &name, digest_kind &kind);
+  protected:
+    void *m_ctx;
+};
+
+#endif//DIGEST_H
@@ -0,0 +1,241 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "dir_walker.h"
+#include "perf_stats.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+/* Bytes of directory entries fetched per getdents64 call. */
+#define WALK_BUFFER (64*1024)
+
+/* A directory descriptor, kept open while its children still need it. */
+struct dir_walker::handle {
+  explicit handle(int _fd): fd(_fd) {}
+  handle(const handle &)=delete;
+  handle &operator=(const handle &)=delete;
+  ~handle() {
+    close(fd);
+  }
+  int fd;
+};
+
+/* Call visit(name, d_type) for every entry of the open directory fd. */
+template<typename VISIT>
+static void read_entries(int fd, VISIT visit) {
+#if defined(__linux__) && defined(SYS_getdents64)
+  struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+  static thread_local std::vector<char> buffer(WALK_BUFFER);
+  long n;
+  while((n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size())) > 0) {
+    for(long offset=0; offset<n; ) {
+      const linux_dirent64 *d = (const linux_dirent64 *)(buffer.data() + offset);
+      visit(d->d_name, d->d_type);
+      offset += d->d_reclen;
+    }
+  }
+#else
+  DIR *cd = fdopendir(dup(fd));
+  if(cd==NULL) return;
+  struct dirent *dirinfo;
+  while((dirinfo = readdir(cd)) != NULL) {
+    visit(dirinfo->d_name, dirinfo->d_type);
+  }
+  closedir(cd);
+#endif
+}
+
+/* fstatat(), counted for --stats. */
+static int counted_stat(int fd, const char *name, struct stat *info, int at_flags) {
+  stats.add_stat();
+  return fstatat(fd, name, info, at_flags);
+}
+
+dir_walker::dir_walker(thread_pool &pool, path_filter include, path_filter read_only, path_visitor opened)
+  : m_pool(pool), m_include(include), m_read_only(read_only), m_opened(opened), m_entries(0), m_progress_lock()
+    , m_held(0), m_scanned_lock(), m_scanned()
+{}
+
+void dir_walker::spin() {
+  static const char indicator[] = "-\\|/";
+  size_t count = ++m_entries;
+  if(ISFLAG(flags, F_HIDEPROGRESS) || (count & 255)!=1) return;
+  std::unique_lock<std::mutex> guard(m_progress_lock, std::try_to_lock);
+  if(guard.owns_lock()) fprintf(stderr, "\rBuilding file list %c ", indicator[(count >> 8) % 4]);
+}
+
+void dir_walker::walk(const std::string &root, bool read_only, file_store &files) {
+  directory top(root, read_only, std::shared_ptr<handle>(), root);
+  task_group tasks(m_pool);
+  flatten(top, files.add_directory(NO_PARENT, root.c_str(), read_only), files, tasks);
+  /* what is still queued was claimed by the walk and returns at once */
+  tasks.wait();
+}
+
+/* Publish dir's entries; the scan must not touch dir after this. */
+void dir_walker::finish(directory *dir) {
+  m_held += dir->entries.size();
+  {
+    std::lock_guard<std::mutex> guard(m_scanned_lock);
+    dir->scanned = true;
+  }
+  m_scanned.notify_all();
+}
+
+/*
+ * For a scan queued on the pool: wait while too much is held, then
+ * claim the directory; false if the walk got to it first, in which
+ * case the directory may already be gone.
+ */
+bool dir_walker::claim_queued(std::atomic<bool> &claimed) {
+  if(claimed) return false;
+  if(m_held>=WALK_MAX_HELD) {
+    std::unique_lock<std::mutex> guard(m_scanned_lock);
+    m_scanned.wait(guard, [this, &claimed]() { return m_held<WALK_MAX_HELD || claimed.load(); });
+  }
+  return !claimed.exchange(true);
+}
+
+/* Scan dir on this thread unless a worker has it, then wait for it. */
+void dir_walker::wait_scanned(directory &dir, task_group &tasks) {
+  if(!dir.claimed->exchange(true)) {
+    scan(&dir, tasks);
+    return;
+  }
+  std::unique_lock<std::mutex> guard(m_scanned_lock);
+  m_scanned.wait(guard, [&dir]() { return dir.scanned.load(); });
+}
+
+void dir_walker::scan(directory *dir, task_group &tasks) {
+  int fd = -1;
+  if(dir->parent) {
+    fd = openat(dir->parent->fd, dir->name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    /* out of descriptors: the full path works just as well */
+    if(fd<0 && (errno==EMFILE || errno==ENFILE)) fd = open(dir->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  } else {
+    fd = open(dir->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  dir->parent.reset();
+  if(fd<0) {
+    errormsg("could not chdir to %s\n", dir->path.c_str());
+    finish(dir);
+    return;
+  }
+
+  stats.add_directory();
+  if(m_opened) m_opened(dir->path);
+  std::shared_ptr<handle> self = std::make_shared<handle>(fd);
+  read_entries(fd, [this, dir, &self, &tasks](const char *entry_name, unsigned char type) {
+    if(strcmp(entry_name, ".") && strcmp(entry_name, "..")) {
+      spin();
+      add_entry(dir, self, entry_name, type, tasks);
+    }
+  });
+  finish(dir);
+}
+
+void dir_walker::add_entry(directory *dir, const std::shared_ptr<handle> &self, const char *name, unsigned char type, task_group &tasks) {
+  struct stat info;
+  bool is_link = false;
+
+  switch(type) {
+    case DT_REG:
+      if(counted_stat(self->fd, name, &info, AT_SYMLINK_NOFOLLOW) == -1) return;
+      break;
+    case DT_DIR:
+      if(!ISFLAG(flags, F_RECURSE)) return;
+      /* only an empty-file filter needs the directory's size */
+      if(ISFLAG(flags, F_EXCLUDEEMPTY) && counted_stat(self->fd, name, &info, 0) == -1) return;
+      if(!ISFLAG(flags, F_EXCLUDEEMPTY)) info.st_mode = S_IFDIR;
+      break;
+    case DT_LNK:
+      if(!ISFLAG(flags, F_FOLLOWLINKS)) return;
+      if(counted_stat(self->fd, name, &info, 0) == -1) return;
+      is_link = true;
+      break;
+    case DT_UNKNOWN:
+      if(counted_stat(self->fd, name, &info, AT_SYMLINK_NOFOLLOW) == -1) return;
+      if(S_ISLNK(info.st_mode)) {
+        if(!ISFLAG(flags, F_FOLLOWLINKS)) return;
+        if(counted_stat(self->fd, name, &info, 0) == -1) return;
+        is_link = true;
+      }
+      break;
+    default:
+      /* devices, fifos and sockets are never candidates */
+      return;
+  }
+
+  if(ISFLAG(flags, F_EXCLUDEEMPTY) && info.st_size == 0) return;
+
+  std::string path = dir->path;
+  if(!path.empty() && path[path.length()-1] != '/') path.push_back('/');
+  path += name;
+
+  if(S_ISDIR(info.st_mode)) {
+    if(!ISFLAG(flags, F_RECURSE)) return;
+    entry &subdir = add_name(dir, name);
+    subdir.child.reset(new directory(path, dir->read_only || m_read_only(name), self, name));
+    /* alone, the walk scans every directory itself as it reaches it */
+    if(m_pool.size()>1) {
+      directory *child = subdir.child.get();
+      std::shared_ptr<std::atomic<bool>> claimed = child->claimed;
+      tasks.run([this, child, claimed, &tasks]() {
+        if(claim_queued(*claimed)) scan(child, tasks);
+      });
+    }
+    return;
+  }
+
+  if(!is_link && !S_ISREG(info.st_mode)) return;
+  if(info.st_size <= min_size) return;
+  if(!m_include(path)) return;
+
+  entry &file = add_name(dir, name);
+  file.size = info.st_size;
+  file.device = info.st_dev;
+  file.inode = info.st_ino;
+  file.mtime = time_ns(info.st_mtim);
+  file.ctime = time_ns(info.st_ctim);
+}
+
+dir_walker::entry &dir_walker::add_name(directory *dir, const char *name) {
+  dir->entries.push_back(entry());
+  dir->entries.back().name = dir->names.size();
+  dir->names.append(name, strlen(name) + 1);
+  return dir->entries.back();
+}
+
+void dir_walker::flatten(directory &dir, dir_id id, file_store &files, task_group &tasks) {
+  wait_scanned(dir, tasks);
+  for(auto it=dir.entries.begin(); it!=dir.entries.end(); ++it) {
+    const char *name = dir.names.c_str() + it->name;
+    if(it->child) {
+      flatten(*it->child, files.add_directory(id, name, it->child->read_only), files, tasks);
+      it->child.reset();
+    } else {
+      files.add_file(id, name, it->size, it->device, it->inode, it->mtime, it->ctime);
+    }
+  }
+  /* wake queued scans held back for room */
+  std::unique_lock<std::mutex> guard(m_scanned_lock);
+  bool full = m_held.fetch_sub(dir.entries.size())>=WALK_MAX_HELD;
+  guard.unlock();
+  if(full) m_scanned.notify_all();
+}
@@ -0,0 +1,100 @@
+#ifndef DIR_WALKER_H
+#define DIR_WALKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fdupes.h"
+#include "file_store.h"
+#include "thread_pool.h"
+
+/* Entries scanned but not yet handed to the file_store past which
+ * scans queued on the pool wait for the walk to catch up. */
+#define WALK_MAX_HELD (size_t)65536
+
+/*
+ * Parallel directory scanner. Each directory is read relative to its
+ * parent's descriptor (openat/fstatat) with getdents64; d_type spares
+ * the stat wherever the entry's type is all that matters. Results are
+ * kept per directory and added to the file_store in the order a serial
+ * depth-first readdir walk would have produced them, each directory
+ * freed as soon as it has been handed over.
+ *
+ * The walking thread scans every directory it reaches itself, unless
+ * a pool worker has already claimed it, so with one thread only the
+ * directories on the current path are held. Workers take directories
+ * queued ahead of the walk, but hold back while WALK_MAX_HELD entries
+ * are waiting to be handed over.
+ *
+ * Honours F_RECURSE, F_FOLLOWLINKS, F_EXCLUDEEMPTY and min_size.
+ */
+class dir_walker {
+  public:
+    typedef std::function<bool(const std::string &)> path_filter;
+    typedef std::function<void(const std::string &)> path_visitor;
+
+    /* include is given full paths of files, read_only directory names;
+     * opened, if set, the path of each directory just before its entries
+     * are read, from any thread of the pool */
+    dir_walker(thread_pool &pool, path_filter include, path_filter read_only, path_visitor opened=path_visitor());
+    dir_walker(const dir_walker &)=delete;
+    dir_walker &operator=(const dir_walker &)=delete;
+
+    /* Add root and the files below it to files, in serial walk order. */
+    void walk(const std::string &root, bool read_only, file_store &files);
+  protected:
+    struct directory;
+    struct handle;
+    struct entry {
+      entry(): name(0), size(0), device(0), inode(0), mtime(0), ctime(0), child() {}
+      size_t name;   /* offset into the directory's names */
+      off_t size;
+      dev_t device;
+      ino_t inode;
+      int64_t mtime;   /* nanoseconds */
+      int64_t ctime;
+      std::unique_ptr<directory> child;
+    };
+    struct directory {
+      directory(const std::string &_path, bool _read_only, std::shared_ptr<handle> _parent, const std::string &_name)
+        : path(_path), read_only(_read_only), parent(_parent), name(_name)
+        , claimed(std::make_shared<std::atomic<bool>>(false)), scanned(false), names(), entries()
+      {}
+      std::string path;
+      bool read_only;
+      /* how to open it: name relative to parent, or path for a root */
+      std::shared_ptr<handle> parent;
+      std::string name;
+      /* set by whoever scans it; outlives the directory for queued scans */
+      std::shared_ptr<std::atomic<bool>> claimed;
+      std::atomic<bool> scanned;   /* entries complete */
+      std::string names;
+      std::vector<entry> entries;
+    };
+
+    void scan(directory *dir, task_group &tasks);
+    void add_entry(directory *dir, const std::shared_ptr<handle> &self, const char *name, unsigned char type, task_group &tasks);
+    entry &add_name(directory *dir, const char *name);
+    void finish(directory *dir);
+    bool claim_queued(std::atomic<bool> &claimed);
+    void wait_scanned(directory &dir, task_group &tasks);
+    void flatten(directory &dir, dir_id id, file_store &files, task_group &tasks);
+    void spin();
+
+    thread_pool &m_pool;
+    path_filter m_include;
+    path_filter m_read_only;
+    path_visitor m_opened;
+    std::atomic<size_t> m_entries;
+    std::mutex m_progress_lock;
+    std::atomic<size_t> m_held;
+    std::mutex m_scanned_lock;
+    std::condition_variable m_scanned;
+};
+
+#endif//DIR_WALKER_H
@@ -0,0 +1,138 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "dir_watcher.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_INOTIFY_H) && defined(__linux__)
+# include <sys/inotify.h>
+# define INOTIFY_SUPPORTED
+#endif
+
+/* Bytes of events read per call. */
+#define WATCH_BUFFER (64*1024)
+
+#ifdef INOTIFY_SUPPORTED
+/* Only changes to entries matter, and the directory going away. */
+# define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | \
+                    IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+#endif
+
+dir_watcher::dir_watcher()
+  : m_fd(-1), m_dirs(), m_watches()
+{}
+
+dir_watcher::~dir_watcher() {
+  if(m_fd>=0) close(m_fd);
+}
+
+bool dir_watcher::open() {
+#ifdef INOTIFY_SUPPORTED
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  return m_fd>=0;
+#else
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+bool dir_watcher::watch(const std::string &path) {
+#ifdef INOTIFY_SUPPORTED
+  return inotify_add_watch(m_fd, path.c_str(), WATCH_MASK)>=0;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+bool dir_watcher::add(const std::string &path, dir_id dir) {
+#ifdef INOTIFY_SUPPORTED
+  /* a path watched already keeps its descriptor */
+  int wd = inotify_add_watch(m_fd, path.c_str(), WATCH_MASK);
+  if(wd<0) return false;
+  m_dirs[wd] = dir;
+  m_watches[dir] = wd;
+  return true;
+#else
+  (void)path;
+  (void)dir;
+  return false;
+#endif
+}
+
+void dir_watcher::remove(dir_id dir) {
+  auto it = m_watches.find(dir);
+  if(it==m_watches.end()) return;
+#ifdef INOTIFY_SUPPORTED
+  inotify_rm_watch(m_fd, it->second);
+#endif
+  m_dirs.erase(it->second);
+  m_watches.erase(it);
+}
+
+void dir_watcher::renumber(const std::vector<dir_id> &ids) {
+  m_watches.clear();
+  for(auto it=m_dirs.begin(); it!=m_dirs.end(); ) {
+    it->second = ids[it->second];
+    if(it->second==NO_PARENT) {
+      it = m_dirs.erase(it);
+    } else {
+      m_watches[it->second] = it->first;
+      ++it;
+    }
+  }
+}
+
+bool dir_watcher::wait(int timeout_ms, std::vector<watch_event> &events) {
+#ifdef INOTIFY_SUPPORTED
+  struct pollfd waiting;
+  waiting.fd = m_fd;
+  waiting.events = POLLIN;
+  int ready = poll(&waiting, 1, timeout_ms);
+  if(ready<0) return errno==EINTR;
+  if(ready==0) return true;
+
+  static char buffer[WATCH_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t n;
+  while((n = read(m_fd, buffer, sizeof(buffer))) > 0) {
+    for(char *p=buffer; p<buffer+n; p+=sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      if(event->mask & IN_Q_OVERFLOW) {
+        events.push_back(watch_event{WATCH_OVERFLOW, NO_PARENT, std::string()});
+        continue;
+      }
+      auto dir = m_dirs.find(event->wd);
+      if(dir==m_dirs.end()) continue;
+      if(event->mask & IN_IGNORED) {
+        /* the directory is gone, or was removed from the watch */
+        m_watches.erase(dir->second);
+        m_dirs.erase(dir);
+        continue;
+      }
+      if(event->mask & IN_DELETE_SELF) {
+        events.push_back(watch_event{WATCH_DIR_REMOVED, dir->second, std::string()});
+        continue;
+      }
+      std::string name = event->len>0 ? event->name : "";
+      watch_change change;
+      if(event->mask & IN_ISDIR) {
+        change = event->mask & (IN_CREATE | IN_MOVED_TO) ? WATCH_DIR_ADDED : WATCH_DIR_REMOVED;
+      } else {
+        change = event->mask & (IN_DELETE | IN_MOVED_FROM) ? WATCH_FILE_REMOVED : WATCH_FILE_WRITTEN;
+      }
+      events.push_back(watch_event{change, dir->second, name});
+    }
+  }
+  return n==0 || errno==EAGAIN || errno==EINTR;
+#else
+  (void)timeout_ms;
+  (void)events;
+  return false;
+#endif
+}
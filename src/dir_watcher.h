@@ -0,0 +1,54 @@
+#ifndef DIR_WATCHER_H
+#define DIR_WATCHER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "file_store.h"
+
+/* What happened to an entry of a watched directory. */
+enum watch_change {
+  WATCH_FILE_WRITTEN,   /* created, written and closed, or moved in */
+  WATCH_FILE_REMOVED,   /* deleted or moved away */
+  WATCH_DIR_ADDED,      /* created or moved in */
+  WATCH_DIR_REMOVED,    /* deleted or moved away; name empty for dir itself */
+  WATCH_OVERFLOW        /* the kernel dropped events */
+};
+
+struct watch_event {
+  watch_change change;
+  dir_id dir;
+  std::string name;
+};
+
+/*
+ * inotify on the directories of a file_store. Only the entries of each
+ * directory are watched, so new subdirectories have to be added as
+ * they appear. Unavailable off Linux: open() then fails.
+ */
+class dir_watcher {
+  public:
+    dir_watcher();
+    dir_watcher(const dir_watcher &)=delete;
+    dir_watcher &operator=(const dir_watcher &)=delete;
+    ~dir_watcher();
+
+    bool open();
+    /* Start watching path without naming it yet; safe from any thread.
+     * Events for it are kept by the kernel until add() names it. */
+    bool watch(const std::string &path);
+    bool add(const std::string &path, dir_id dir);
+    void remove(dir_id dir);
+    /* After file_store::compact(): dir becomes ids[dir]. */
+    void renumber(const std::vector<dir_id> &ids);
+    /* Wait up to timeout_ms (-1: for ever) for events and append all
+     * that have arrived; false on error. */
+    bool wait(int timeout_ms, std::vector<watch_event> &events);
+  protected:
+    int m_fd;
+    std::unordered_map<int, dir_id> m_dirs;
+    std::unordered_map<dir_id, int> m_watches;
+};
+
+#endif//DIR_WATCHER_H
@@ -0,0 +1,113 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "extent_map.h"
+
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#if defined(HAVE_LINUX_FIEMAP_H) && defined(__linux__)
+# include <linux/fiemap.h>
+# include <linux/fs.h>
+# define FIEMAP_SUPPORTED
+#endif
+
+#ifdef FIEMAP_SUPPORTED
+static bool fiemap_first(int fd, uint64_t &physical) {
+  union {
+    struct fiemap map;
+    char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.map.fm_start = 0;
+  request.map.fm_length = FIEMAP_MAX_OFFSET;
+  request.map.fm_extent_count = 1;
+  if(ioctl(fd, FS_IOC_FIEMAP, &request.map) < 0) return false;
+  if(request.map.fm_mapped_extents==0) return false;
+
+  const struct fiemap_extent &extent = request.map.fm_extents[0];
+  if(extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE)) return false;
+  physical = extent.fe_physical;
+  return true;
+}
+
+/* Extents asked for per FIEMAP call. */
+#define FIEMAP_BATCH 64
+
+static bool fiemap_shared(int fd, std::vector<extent> &extents) {
+  union {
+    struct fiemap map;
+    char buffer[sizeof(struct fiemap) + FIEMAP_BATCH * sizeof(struct fiemap_extent)];
+  } request;
+  extents.clear();
+  for(uint64_t start=0; ; ) {
+    memset(&request, 0, sizeof(request));
+    request.map.fm_start = start;
+    request.map.fm_length = FIEMAP_MAX_OFFSET - start;
+    request.map.fm_extent_count = FIEMAP_BATCH;
+    /* flush first: an unwritten overwrite leaves the old extent marked shared */
+    request.map.fm_flags = FIEMAP_FLAG_SYNC;
+    if(ioctl(fd, FS_IOC_FIEMAP, &request.map) < 0) return false;
+    if(request.map.fm_mapped_extents==0) break;
+
+    for(uint32_t i=0; i<request.map.fm_mapped_extents; i++) {
+      const struct fiemap_extent &found = request.map.fm_extents[i];
+      if(!(found.fe_flags & FIEMAP_EXTENT_SHARED)) return false;
+      if(found.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_DATA_INLINE)) return false;
+      if(!extents.empty() && extents.back().logical + extents.back().length==found.fe_logical
+          && extents.back().physical + extents.back().length==found.fe_physical) {
+        extents.back().length += found.fe_length;
+      } else {
+        extents.push_back(extent{found.fe_logical, found.fe_physical, found.fe_length});
+      }
+    }
+    const struct fiemap_extent &last = request.map.fm_extents[request.map.fm_mapped_extents-1];
+    if(last.fe_flags & FIEMAP_EXTENT_LAST) break;
+    start = last.fe_logical + last.fe_length;
+  }
+  return !extents.empty();
+}
+
+static bool fibmap_first(int fd, uint64_t &physical) {
+  int block = 0, block_size = 0;
+  if(ioctl(fd, FIGETBSZ, &block_size) < 0 || ioctl(fd, FIBMAP, &block) < 0) return false;
+  if(block==0) return false;
+  physical = (uint64_t)block * block_size;
+  return true;
+}
+#endif
+
+bool first_extent(const std::string &path, uint64_t &physical) {
+#ifdef FIEMAP_SUPPORTED
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+  if(fd<0) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd<0) return false;
+  bool found = fiemap_first(fd, physical) || fibmap_first(fd, physical);
+  close(fd);
+  return found;
+#else
+  (void)path;
+  (void)physical;
+  return false;
+#endif
+}
+
+bool shared_extents(const std::string &path, std::vector<extent> &extents) {
+#ifdef FIEMAP_SUPPORTED
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+  if(fd<0) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd<0) return false;
+  bool found = fiemap_shared(fd, extents);
+  close(fd);
+  return found;
+#else
+  (void)path;
+  (void)extents;
+  return false;
+#endif
+}
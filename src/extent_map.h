@@ -0,0 +1,39 @@
+#ifndef EXTENT_MAP_H
+#define EXTENT_MAP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Where a file's data starts on its device, in bytes: the first extent
+ * reported by FIEMAP, or block 0 from FIBMAP where FIEMAP is missing.
+ * False for files without allocated data, or whose layout the
+ * filesystem will not disclose.
+ */
+bool first_extent(const std::string &path, uint64_t &physical);
+
+struct extent {
+  uint64_t logical;
+  uint64_t physical;
+  uint64_t length;
+
+  bool operator==(const extent &other) const {
+    return logical==other.logical && physical==other.physical && length==other.length;
+  }
+  bool operator<(const extent &other) const {
+    if(logical!=other.logical) return logical<other.logical;
+    if(physical!=other.physical) return physical<other.physical;
+    return length<other.length;
+  }
+};
+
+/*
+ * Every data extent of a file from FIEMAP, after flushing its dirty
+ * pages, extents adjacent both in the file and on disk merged. False unless all of them are marked
+ * shared with another file and are in their final place (not delayed
+ * or inline), since only then can two files' maps be the same.
+ */
+bool shared_extents(const std::string &path, std::vector<extent> &extents);
+
+#endif//EXTENT_MAP_H
@@ -6,92 +6,100 @@
 #include <cstdlib>
 #include <cstdarg>
 #include <cstring>
+#include <cctype>
 #include <cassert>
 
 #include <iostream>
 #include <string>
-#include <forward_list>
 #include <map>
 #include <set>
-#include <deque>
 #include <vector>
-
-#include <dirent.h>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <limits>
+
+#include <getopt.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#ifdef HAVE_FNMATCH_H
-# include <fnmatch.h>
-#endif
 #include "crc_32.h"
+#include "fdupes.h"
+#include "thread_pool.h"
+#include "hash_cache.h"
+#include "file_reader.h"
+#include "uring_reader.h"
+#include "dir_walker.h"
+#include "file_store.h"
+#include "extent_map.h"
+#include "io_scheduler.h"
+#include "dedupe.h"
+#include "digest.h"
+#include "file_sampler.h"
+#include "json.h"
+#include "perf_stats.h"
+#include "dir_watcher.h"
+#include "glob_set.h"
 
-#define MAX_PARTIAL_SIZE (off_t)1024
+off_t min_size = 0;
+unsigned int num_threads = 1;
+hash_cache cache;
+/* --watch: opened before the first scan, so nothing it walks is missed */
+dir_watcher watcher;
+read_backend io_backend = READ_PREAD;
+unsigned int uring_depth = 0;
+io_scheduler io_queues;
+digest_kind strong_hash = DIGEST_NONE;
+file_sampler sampler;
+
+enum output_format {
+  OUTPUT_TEXT,    /* sets printed once everything is matched */
+  OUTPUT_NDJSON   /* one JSON object per set, as soon as it is found */
+};
+output_format output = OUTPUT_TEXT;
+std::mutex output_lock;
 
-#define ISFLAG(a,b) ((a & b) == b)
-#define SETFLAG(a,b) (a |= b)
+perf_stats stats;
+bool stats_json = false;
 
-#define F_RECURSE           0x0001
-#define F_HIDEPROGRESS      0x0002
-#define F_DSAMELINE         0x0004
-#define F_FOLLOWLINKS       0x0008
-#define F_DELETEFILES       0x0010
-#define F_EXCLUDEEMPTY      0x0020
-#define F_CONSIDERHARDLINKS 0x0040
-#define F_SHOWSIZE          0x0080
-#define F_NOPROMPT          0x0100
-off_t min_size = 0;
+/* Where scan records are spilled to; empty keeps them in memory. */
+std::string spill_dir;
 
-class crc32 {
-  public:
-    bool valid;
-    uint32_t crc;
+/* Keep watching for changes after the first report. */
+bool watch = false;
 
-    crc32()
-      : valid(false), crc(0)
-    {}
-    bool operator!=(const crc32 &other) const {
-      return (valid!=other.valid || crc!=other.crc);
-    }
-    bool operator==(const crc32 &other) const {
-      return (valid==other.valid && crc==other.crc);
-    }
-    crc32 &operator=(uint32_t t_crc) {
-      crc = t_crc;
-      valid = true;
-      return *this;
-    }
-};
+/* Report identical directory trees as one set each (--trees). */
+bool trees = false;
 
-class file_t {
-  public:
-    std::string name;
-    off_t size;
-    dev_t device;
-    ino_t inode;
-    time_t mtime;
-    bool checked;
-    bool read_only;
-
-    class crc32 crcpartial;
-    class crc32 crcfull;
-
-    file_t()
-      : name(), size(0)
-        , device(0), inode(0), mtime(0)
-        , checked(false)
-        , read_only(false)
-        , crcpartial(), crcfull()
-  {}
+/* What to do with candidates sharing all their extents (--reflinks). */
+enum reflink_mode {
+  REFLINKS_READ,      /* read them like any other file */
+  REFLINKS_REPORT,    /* read one, report the others marked */
+  REFLINKS_EXCLUDE    /* read one, leave the others out */
 };
+reflink_mode reflinks = REFLINKS_READ;
+
+/* --savings-first: buckets by reclaimable bytes, until a budget is spent */
+bool savings_first = false;
+perf_stats::clock::time_point deadline = perf_stats::clock::time_point::max();
+uint64_t read_budget = 0;   /* 0 for none */
 
 unsigned long flags = 0;
 size_t filecount = 0;
 size_t read_only_file_count = 0;
 
 std::string program_name;
-//std::forward_list<file_t> filelist;
-std::map<off_t, std::deque<std::forward_list<file_t>>> filelist;
-std::set<std::string> globs;
+file_store files;
+
+/* Duplicate sets, largest files first. */
+typedef std::vector<file_id> match_set;
+std::vector<match_set> matches;
+/* -i patterns, matched against full paths */
+glob_set globs;
 
 void tokenize(const std::string& str, std::vector<std::string>& tokens, const std::string& delimiters = " ", bool permit_empty=false) {
   if(permit_empty)
@@ -130,30 +138,22 @@ void tokenize(const std::string& str, std::vector<std::string>& tokens, const st
   }
 }
 
-std::set<std::string> read_only;
+/* -R names, matched against each component of a path, and as given */
+glob_set read_only_names;
+std::vector<std::string> read_only_list;
+
+/* The walker passes single directory names; roots are whole paths. */
 bool is_readonly(const std::string &path) {
-  std::vector<std::string> path_parts;
-  tokenize(path, path_parts, "\\/", false);
-  for(auto it=path_parts.begin(); it!=path_parts.end(); ++it) {
-    if(read_only.find(*it)!=read_only.end()) {
-      //fprintf( stderr, "is_readonly('%s')\n", path.c_str() );
-      return true;
-    }
-  }
-  return false;
+  return read_only_names.match_component(path);
 }
 
 bool glob_include( const std::string &name ) {
-  if( globs.size()==0 ) return true;
-#ifdef HAVE_FNMATCH_H
-  for( std::set<std::string>::const_iterator it=globs.begin(); it!=globs.end(); ++it) {
-    if( fnmatch(it->c_str(), name.c_str(), 0/*FNM_PATHNAME*/)==0 ) {
-      //printf( "'%s' matches '%s'.\n", name.c_str(), it->c_str() );
-      return true;
-    }
-  }
-#endif
-  return false;
+  return globs.empty() || globs.match(name);
+}
+
+/* Watch a directory about to be walked, before it is read. */
+void watch_directory(const std::string &path) {
+  if(!watcher.watch(path)) errormsg("could not watch %s: %s\n", path.c_str(), strerror(errno));
 }
 
 void errormsg(const char *message, ...)
@@ -166,179 +166,160 @@ void errormsg(const char *message, ...)
   vfprintf(stderr, message, ap);
 }
 
-void scandir(const std::string &dir, bool read_only)
-{
-  DIR *cd;
-  struct dirent *dirinfo;
-  int lastchar;
+/* Parse path=depth and set the read depth of the device holding path. */
+bool parse_device_depth(const std::string &arg) {
+  std::string::size_type split = arg.rfind('=');
+  if(split==std::string::npos || split==0 || split+1==arg.length()) return false;
   struct stat info;
-  struct stat linfo;
-  static int progress = 0;
-  static char indicator[] = "-\\|/";
-
-  cd = opendir(dir.c_str());
-
-  if (!cd) {
-    errormsg("could not chdir to %s\n", dir.c_str());
-    return;
-  }
+  if(stat(arg.substr(0, split).c_str(), &info)!=0) return false;
+  io_queues.set_depth(info.st_dev, atoi(arg.c_str() + split + 1));
+  return true;
+}
 
-  //errormsg("Scanning %s\n", dir.c_str());
+/* Parse a duration in seconds, or with an s, m or h suffix. */
+bool parse_duration(const char *arg, perf_stats::clock::duration &duration) {
+  char *end;
+  double value = strtod(arg, &end);
+  double unit = 1;
+  if(*end=='m') unit = 60;
+  if(*end=='h') unit = 3600;
+  if(*end=='s' || unit>1) end++;
+  if(end==arg || *end || value<0) return false;
+  duration = std::chrono::duration_cast<perf_stats::clock::duration>(std::chrono::duration<double>(value * unit));
+  return true;
+}
 
-  lastchar = dir.length() - 1;
-  bool add_dir_separator = false;
-  if(lastchar >= 0 && dir[lastchar] != '/') {
-    add_dir_separator = true;
+/* Parse a byte count, optionally with a K, M, G or T (binary) suffix. */
+bool parse_bytes(const char *arg, uint64_t &bytes) {
+  char *end;
+  double value = strtod(arg, &end);
+  const char *units = "KMGT";
+  const char *unit = *end ? strchr(units, toupper(*end)) : NULL;
+  if(unit) {
+    value *= (double)(1ULL << (10 * (unit - units + 1)));
+    end++;
   }
-  while ((dirinfo = readdir(cd)) != NULL) {
-    if (strcmp(dirinfo->d_name, ".") && strcmp(dirinfo->d_name, "..")) {
-      if (!ISFLAG(flags, F_HIDEPROGRESS)) {
-        fprintf(stderr, "\rBuilding file list %c ", indicator[progress]);
-        progress = (progress + 1) % 4;
-      }
-
-      file_t newfile;
-
-      newfile.name = dir;
-      if (add_dir_separator) newfile.name.push_back('/');
-      newfile.name += dirinfo->d_name;
-
-      if (stat(newfile.name.c_str(), &info) == -1) {
-        continue;
-      }
-
-      if (lstat(newfile.name.c_str(), &linfo) == -1) {
-        continue;
-      }
-
-      newfile.size = info.st_size;
-      newfile.device = info.st_dev;
-      newfile.inode = info.st_ino;
-      newfile.mtime = info.st_mtime;
-      newfile.read_only = read_only;
-
-      if (newfile.size == 0 && ISFLAG(flags, F_EXCLUDEEMPTY)) {
-        continue;
-      }
+  if(end==arg || *end || value<0) return false;
+  bytes = (uint64_t)value;
+  return true;
+}
 
-      if (S_ISDIR(info.st_mode)) {
-        if (ISFLAG(flags, F_RECURSE) && (ISFLAG(flags, F_FOLLOWLINKS) || !S_ISLNK(linfo.st_mode))) {
-          scandir(newfile.name, read_only || is_readonly(dirinfo->d_name));
-        }
-      } else {
-        if ( newfile.size > min_size && (S_ISREG(linfo.st_mode) || (S_ISLNK(linfo.st_mode) && ISFLAG(flags, F_FOLLOWLINKS))) ) {
-          if( !glob_include(newfile.name) ) continue;
-          filelist[newfile.size].push_front(std::forward_list<file_t>(1, newfile));
-          filecount ++;
-          if(read_only) read_only_file_count ++;
-        }
-      }
+/* Build the file list from the given roots, in walk order. */
+void scandirs(char *roots[], int count) {
+  phase_timer timer(PHASE_SCAN);
+  {
+    thread_pool pool(num_threads);
+    dir_walker walker(pool, glob_include, is_readonly, watch ? dir_walker::path_visitor(watch_directory) : dir_walker::path_visitor());
+    if(!spill_dir.empty()) files.spill(spill_dir);
+    for (int x = 0; x < count; x++) {
+      walker.walk(roots[x], is_readonly(roots[x]), files);
     }
   }
+  if(!files.merge_spilled()) exit(1);
+  files.shrink();
+  /* spilled files of unique size were never loaded back */
+  stats.add_eliminated(STAGE_SIZE, files.scanned() - files.count());
 
-  closedir(cd);
+  filecount = files.count();
+  read_only_file_count = files.scanned_read_only();
 }
 
 void deletefiles(bool prompt) {
-  unsigned int numsets = 0;
-  for(auto size_it=filelist.rbegin(); size_it!=filelist.rend(); ++size_it) {
-    numsets += size_it->second.size();
-  }
+  unsigned int numsets = matches.size();
 
   unsigned int curgroup = 0;
-  for(auto size_it=filelist.rbegin(); size_it!=filelist.rend(); ++size_it) {
-    auto size = size_it->first;
-    for(auto grp_it=size_it->second.begin(); grp_it!=size_it->second.end(); ++grp_it) {
-      curgroup ++;
-      unsigned int counter = 1;
-      unsigned int num_ro = 0;
-      std::map<unsigned int, std::string> names;
-      std::map<unsigned int, bool> erase;
-      for(auto file_it=grp_it->begin(); file_it!=grp_it->end(); ++file_it) {
-        if(file_it->read_only) {
-          num_ro ++;
-        } else {
-          if (prompt) printf("[%d] %s (%c)\n", counter, file_it->name.c_str(), file_it->read_only ? 'R' : 'W');
-          names[counter] = file_it->name;
-          erase[counter] = true;
-          counter++;
-        }
+  for(auto grp_it=matches.begin(); grp_it!=matches.end(); ++grp_it) {
+    auto size = files.size(grp_it->front());
+    curgroup ++;
+    unsigned int counter = 1;
+    unsigned int num_ro = 0;
+    std::map<unsigned int, std::string> names;
+    std::map<unsigned int, bool> erase;
+    for(auto file_it=grp_it->begin(); file_it!=grp_it->end(); ++file_it) {
+      if(files.read_only(*file_it)) {
+        num_ro ++;
+      } else {
+        std::string path = files.path(*file_it);
+        if (prompt) printf("[%d] %s (%c)\n", counter, path.c_str(), files.read_only(*file_it) ? 'R' : 'W');
+        names[counter] = path;
+        erase[counter] = true;
+        counter++;
       }
-      /* don't delete if no non-protected files */
-      if (counter<=1) continue;
-      if (!prompt) {
-        /* preserve the first file, iff no matches in read_only */
-        erase[1] = (num_ro!=0);
+    }
+    /* don't delete if no non-protected files */
+    if (counter<=1) continue;
+    if (!prompt) {
+      /* preserve the first file, iff no matches in read_only */
+      erase[1] = (num_ro!=0);
+      for(unsigned int i=2; i<counter; i++) {
+        erase[i] = true;
+      }
+    } else {
+      printf("    %u read only.\n", num_ro);
+      printf("\n");
+      /* prompt for files to preserve */
+      unsigned int sum = 0;
+      bool done = false;
+      do {
         for(unsigned int i=2; i<counter; i++) {
           erase[i] = true;
         }
-      } else {
-        printf("    %u read only.\n", num_ro);
-        printf("\n");
-        /* prompt for files to preserve */
-        unsigned int sum = 0;
-        bool done = false;
-        do {
-          for(unsigned int i=2; i<counter; i++) {
-            erase[i] = true;
-          }
 
-          printf("Set %u of %u, preserve files [1 - %u, all, none, quit]", curgroup, numsets, counter-1);
-          if (ISFLAG(flags, F_SHOWSIZE)) printf(" (%zu byte%s each)", size, (size != 1) ? "s" : "");
-          printf(": ");
-          fflush(stdout);
-
-          std::string line;
-          std::getline(std::cin, line);
-
-          std::vector<std::string> tokens;
-          tokenize( line, tokens, " ,\n" );
-          for(auto token=tokens.begin(); token!=tokens.end(); ++token) {
-            if(strcasecmp(token->c_str(), "quit")==0) {
-              return;
-            } else if(strcasecmp(token->c_str(), "all")==0) {
-              for(unsigned int i=1; i<counter; i++) {
-                erase[i] = false;
-              }
-              done = true;
-            } else if(strcasecmp(token->c_str(), "none")==0) {
-              for(unsigned int i=1; i<counter; i++) {
-                erase[i] = true;
-              }
-              done = true;
-            } else {
-              unsigned int number = 0;
-              sscanf(token->c_str(), "%u", &number);
-              if(number > 0 && number < counter) {
-                erase[number] = false;
-              }
+        printf("Set %u of %u, preserve files [1 - %u, all, none, quit]", curgroup, numsets, counter-1);
+        if (ISFLAG(flags, F_SHOWSIZE)) printf(" (%zu byte%s each)", size, (size != 1) ? "s" : "");
+        printf(": ");
+        fflush(stdout);
+
+        std::string line;
+        std::getline(std::cin, line);
+
+        std::vector<std::string> tokens;
+        tokenize( line, tokens, " ,\n" );
+        for(auto token=tokens.begin(); token!=tokens.end(); ++token) {
+          if(strcasecmp(token->c_str(), "quit")==0) {
+            return;
+          } else if(strcasecmp(token->c_str(), "all")==0) {
+            for(unsigned int i=1; i<counter; i++) {
+              erase[i] = false;
+            }
+            done = true;
+          } else if(strcasecmp(token->c_str(), "none")==0) {
+            for(unsigned int i=1; i<counter; i++) {
+              erase[i] = true;
+            }
+            done = true;
+          } else {
+            unsigned int number = 0;
+            sscanf(token->c_str(), "%u", &number);
+            if(number > 0 && number < counter) {
+              erase[number] = false;
             }
           }
+        }
 
-          sum = 0;
-          unsigned int x;
-          for( x=1; x<counter; x++) {
-            sum += erase[x]?0:1;
-          }
-        } while (done==false && sum < 1); /* make sure we've preserved at least one file */
-      }
+        sum = 0;
+        unsigned int x;
+        for( x=1; x<counter; x++) {
+          sum += erase[x]?0:1;
+        }
+      } while (done==false && sum < 1); /* make sure we've preserved at least one file */
+    }
 
-      printf("\n");
+    printf("\n");
 
-      for( unsigned int x=1; x<counter; x++) { 
-        if (!erase[x])
-          printf( "   [+] %s\n", names[x].c_str() );
-        else {
-          if (remove(names[x].c_str()) == 0) {
-            printf("   [-] %s\n", names[x].c_str() );
-          } else {
-            printf("   [!] %s ", names[x].c_str() );
-            printf("-- unable to delete file!\n");
-          }
+    for( unsigned int x=1; x<counter; x++) { 
+      if (!erase[x])
+        printf( "   [+] %s\n", names[x].c_str() );
+      else {
+        if (remove(names[x].c_str()) == 0) {
+          printf("   [-] %s\n", names[x].c_str() );
+        } else {
+          printf("   [!] %s ", names[x].c_str() );
+          printf("-- unable to delete file!\n");
         }
       }
-      printf("\n");
     }
+    printf("\n");
   }
 }
 
@@ -347,13 +328,11 @@ void summarizematches(void) {
   double numbytes = 0.0;
   int numfiles = 0;
 
-  for(auto size_it=filelist.rbegin(); size_it!=filelist.rend(); ++size_it) {
-    for(auto grp_it=size_it->second.begin(); grp_it!=size_it->second.end(); ++grp_it) {
-      numsets++;
-      for(auto file_it=grp_it->begin(); file_it!=grp_it->end(); ++file_it) {
-        numfiles++;
-        numbytes += size_it->first;
-      }
+  for(auto grp_it=matches.begin(); grp_it!=matches.end(); ++grp_it) {
+    numsets++;
+    for(auto file_it=grp_it->begin(); file_it!=grp_it->end(); ++file_it) {
+      numfiles++;
+      numbytes += files.size(*file_it);
     }
   }
   if (numsets == 0) {
@@ -369,99 +348,134 @@ void summarizematches(void) {
   }
 }
 
+void print_set(const match_set &set) {
+  auto size = files.size(set.front());
+  if (ISFLAG(flags, F_SHOWSIZE)) printf("%zu byte%s each:\n", size, (size != 1) ? "s" : "");
+  for(auto file_it=set.begin(); file_it!=set.end(); ++file_it) {
+    printf("%s (%c)%s%c", files.path(*file_it).c_str(), files.read_only(*file_it) ? 'R' : 'W',
+        files.shared_extents(*file_it) ? " (reflinked)" : "", ISFLAG(flags, F_DSAMELINE)?' ':'\n');
+  }
+  printf("\n");
+}
+
 void printmatches(void) {
-  for(auto size_it=filelist.rbegin(); size_it!=filelist.rend(); ++size_it) {
-    auto size = size_it->first;
-    for(auto grp_it=size_it->second.begin(); grp_it!=size_it->second.end(); ++grp_it) {
-      if (ISFLAG(flags, F_SHOWSIZE)) printf("%zu byte%s each:\n", size, (size != 1) ? "s" : "");
-      for(auto file_it=grp_it->begin(); file_it!=grp_it->end(); ++file_it) {
-        printf("%s (%c)%c", file_it->name.c_str(), file_it->read_only ? 'R' : 'W', ISFLAG(flags, F_DSAMELINE)?' ':'\n');
-      }
-      printf("\n");
+  for(auto grp_it=matches.begin(); grp_it!=matches.end(); ++grp_it) {
+    print_set(*grp_it);
+  }
+}
+
+/* Pass the first length bytes of a file to consume, chunk by chunk,
+ * saying whether each lies in a hole and so is all zeros. */
+template<typename CONSUME>
+bool read_file(file_id id, off_t length, perf_stage stage, CONSUME consume) {
+  stage_timer timer(stage);
+  std::string path = files.path(id);
+  std::unique_ptr<file_reader> reader(file_reader::open(path, files.size(id), io_backend));
+  if(!reader) return false;
+
+  off_t total = 0;
+  while(length > 0) {
+    const unsigned char *data;
+    ssize_t r = reader->next(data, length);
+    if(r<=0) {
+      fprintf(stderr, "Failed to read last %zu bytes from '%s'.\n", length, path.c_str());
+      stats.add_read(stage, total);
+      return false;
     }
+    consume(data, r, reader->in_hole());
+    length -= r;
+    /* holes cost no reading */
+    if(!reader->in_hole()) total += r;
   }
+  stats.add_read(stage, total);
+  return true;
 }
 
-void gen_partial_crc(file_t &file) {
-  unsigned char buf[MAX_PARTIAL_SIZE+1];
+/* Checksum the first length bytes of a file; false if it can't be read. */
+bool checksum(file_id id, off_t length, perf_stage stage, uint32_t &crc) {
+  crc = 0;
+  return read_file(id, length, stage, [&crc](const unsigned char *data, size_t n, bool hole) {
+    crc = hole ? crc32_zeros(crc, n) : crc32(crc, data, n);
+  });
+}
 
-  FILE *fp = fopen(file.name.c_str(), "r");
-  if(fp==NULL) return;
+void gen_partial_crc(file_id id) {
+  uint32_t partialcrc;
+  if(!checksum(id, std::min(files.size(id), MAX_PARTIAL_SIZE), STAGE_PARTIAL, partialcrc)) return;
 
-  size_t size = std::min(file.size, MAX_PARTIAL_SIZE);
+  files.set_crcpartial(id, partialcrc);
 
-  uint32_t partialcrc = 0;
-  while(size > 0) {
-    int r = fread(buf, 1, size, fp);
-    if(r>0) {
-      partialcrc = crc32(partialcrc, buf, r);
-    } else {
-      fprintf(stderr, "Failed to read last %zu bytes from '%s'.\n", size, file.name.c_str());
-      fclose(fp);
-      return;
-    }
-    size -= r;
+  if(files.size(id) <= MAX_PARTIAL_SIZE) {
+    files.set_crcfull(id, partialcrc);
   }
+}
 
-  fclose(fp);
-  file.crcpartial = partialcrc;
+void gen_full_crc(file_id id) {
+  uint32_t fullcrc;
+  if(!checksum(id, files.size(id), STAGE_FULL, fullcrc)) return;
 
-  if(file.size <= MAX_PARTIAL_SIZE) {
-    file.crcfull = partialcrc;
-  }
+  files.set_crcfull(id, fullcrc);
 }
 
-void gen_full_crc(file_t &file) {
-  unsigned char buf[MAX_PARTIAL_SIZE+1];
+void gen_sample_crc(file_id id) {
+  stage_timer timer(STAGE_SAMPLE);
+  uint32_t samplecrc;
+  if(!sampler.checksum(files.path(id), files.size(id), samplecrc)) return;
+  stats.add_read(STAGE_SAMPLE, sampler.points() * SAMPLE_BLOCK);
 
-  FILE *fp = fopen(file.name.c_str(), "r");
-  if(fp==NULL) return;
+  files.set_crcsample(id, samplecrc);
+}
 
-  size_t size = file.size;
+void gen_digest(file_id id) {
+  digest_context context(strong_hash);
+  if(!read_file(id, files.size(id), STAGE_FULL, [&context](const unsigned char *data, size_t n, bool) { context.update(data, n); })) return;
 
-  uint32_t fullcrc = 0;
-  while(size > 0) {
-    int r = fread(buf, 1, MAX_PARTIAL_SIZE, fp);
-    if(r>0) {
-      fullcrc = crc32(fullcrc, buf, r);
-    } else {
-      fprintf(stderr, "Failed to read last %zu bytes from '%s'.\n", size, file.name.c_str());
-      fclose(fp);
-      return;
-    }
-    size -= r;
+  digest_t digest;
+  context.final(digest);
+  files.set_digest(id, digest);
+}
+
+/* The hash that decides a match: the full CRC, or the strong digest. */
+void gen_full_hash(file_id id) {
+  if(strong_hash!=DIGEST_NONE) {
+    gen_digest(id);
+  } else {
+    gen_full_crc(id);
   }
+}
 
-  fclose(fp);
-  file.crcfull = fullcrc;
+bool full_hash_known(file_id id) {
+  digest_t digest;
+  return strong_hash!=DIGEST_NONE ? files.digest(id, digest) : files.crcfull(id).valid;
 }
 
-bool byte_match(const file_t &A, const file_t &B) {
-  FILE *fp_a = fopen(A.name.c_str(), "r");
-  if(fp_a==NULL) {
+bool byte_match(file_id A, file_id B) {
+  stage_timer timer(STAGE_COMPARE);
+  std::unique_ptr<file_reader> reader_a(file_reader::open(files.path(A), files.size(A), io_backend));
+  if(!reader_a) {
     return false;
   }
 
-  FILE *fp_b = fopen(B.name.c_str(), "r");
-  if(fp_b==NULL) {
-    fclose(fp_a);
+  std::unique_ptr<file_reader> reader_b(file_reader::open(files.path(B), files.size(B), io_backend));
+  if(!reader_b) {
     return false;
   }
 
-  unsigned char buf_a[MAX_PARTIAL_SIZE+1];
-  unsigned char buf_b[MAX_PARTIAL_SIZE+1];
-
-  off_t size = A.size;
+  off_t size = files.size(A);
+  stats.add_read(STAGE_COMPARE, 0, 2);
 
   while(size > 0) {
-    int a_bytes = fread(buf_a, 1, MAX_PARTIAL_SIZE, fp_a);
-    int b_bytes = fread(buf_b, 1, MAX_PARTIAL_SIZE, fp_b);
+    const unsigned char *buf_a, *buf_b;
+    ssize_t a_bytes = reader_a->next(buf_a, size);
+    ssize_t b_bytes = reader_b->next(buf_b, size);
+    stats.add_read(STAGE_COMPARE, (reader_a->in_hole() ? 0 : std::max(a_bytes, (ssize_t)0)) + (reader_b->in_hole() ? 0 : std::max(b_bytes, (ssize_t)0)), 0);
 
     if(a_bytes!=b_bytes) {
       /* Didn't read synchronously */
       return false;
     } else if(a_bytes>0) {
-      if (memcmp (buf_a, buf_b, a_bytes)) {
+      /* holes in both share the same zeros */
+      if (buf_a!=buf_b && memcmp (buf_a, buf_b, a_bytes)) {
         /* file contents are different */
         return false;
       }
@@ -471,95 +485,1383 @@ bool byte_match(const file_t &A, const file_t &B) {
     }
     size -= a_bytes;
   }
-  fclose(fp_b);
-  fclose(fp_a);
 
   return true;
 }
 
-bool groups_match(std::forward_list<file_t> &groupA, std::forward_list<file_t> &groupB) {
-  file_t &fileA = *groupA.begin();
-  file_t &fileB = *groupB.begin();
+/*
+ * Make the members of every set share storage instead of deleting them,
+ * so that all paths stay in place. Each writable member is deduplicated
+ * against one source, a read only member if the set has one. Where the
+ * filesystem cannot share extents the member is replaced by a hard link
+ * instead, after a byte comparison since nothing else has checked the
+ * contents in this mode.
+ */
+void dedupefiles() {
+  size_t deduped = 0;
+  double shared = 0.0;
+  for(auto grp_it=matches.begin(); grp_it!=matches.end(); ++grp_it) {
+    off_t size = files.size(grp_it->front());
+    if(size==0) continue;
+
+    auto source_it = std::find_if(grp_it->begin(), grp_it->end(), [](file_id id) { return files.read_only(id); });
+    if(source_it==grp_it->end()) source_it = grp_it->begin();
+    file_id source = *source_it;
+    std::string source_path = files.path(source);
+    printf("   [+] %s\n", source_path.c_str());
+
+    for(auto file_it=grp_it->begin(); file_it!=grp_it->end(); ++file_it) {
+      if(file_it==source_it) continue;
+      std::string path = files.path(*file_it);
+      if(files.read_only(*file_it)) {
+        printf("   [+] %s\n", path.c_str());
+        continue;
+      }
+      if(files.device(*file_it)==files.device(source) && files.inode(*file_it)==files.inode(source)) {
+        printf("   [=] %s (hard link)\n", path.c_str());
+        continue;
+      }
 
-  assert(fileA.size==fileB.size);
-  if(fileA.size==0) return true;
+      dedupe_result result = dedupe_range(source_path, path, size);
+      if(result==DEDUPE_UNSUPPORTED) {
+        if(files.device(*file_it)!=files.device(source)) {
+          printf("   [!] %s -- on another filesystem, unable to link\n", path.c_str());
+          continue;
+        }
+        if(!byte_match(source, *file_it)) {
+          result = DEDUPE_DIFFERS;
+        } else if(replace_with_link(source_path, path)) {
+          printf("   [=] %s (hard link)\n", path.c_str());
+          deduped++;
+          shared += size;
+          continue;
+        } else {
+          result = DEDUPE_FAILED;
+        }
+      }
 
-  if(!fileA.crcpartial.valid) gen_partial_crc(fileA);
-  if(!fileB.crcpartial.valid) gen_partial_crc(fileB);
-  if(!fileA.crcpartial.valid || !fileB.crcpartial.valid || fileA.crcpartial != fileB.crcpartial) {
-    //fprintf(stderr, "A: '%s' - partial CRC %u - Valid %s\n", fileA.name.c_str(), fileA.crcpartial.crc, fileA.crcpartial.valid?"TRUE":"FALSE");
-    //fprintf(stderr, "B: '%s' - partial CRC %u - Valid %s\n", fileB.name.c_str(), fileB.crcpartial.crc, fileB.crcpartial.valid?"TRUE":"FALSE");
-    return false;
+      if(result==DEDUPE_SHARED) {
+        printf("   [=] %s\n", path.c_str());
+        deduped++;
+        shared += size;
+      } else if(result==DEDUPE_DIFFERS) {
+        printf("   [!] %s -- contents differ\n", path.c_str());
+      } else {
+        printf("   [!] %s -- unable to dedupe: %s\n", path.c_str(), strerror(errno));
+      }
+    }
+    printf("\n");
   }
+  printf("%zu file%s deduplicated, %.1f megabytes shared.\n", deduped, deduped!=1 ? "s" : "", shared / (1024.0 * 1024.0));
+}
 
-  if(!fileA.crcfull.valid) gen_full_crc(fileA);
-  if(!fileB.crcfull.valid) gen_full_crc(fileB);
-  if(fileA.crcfull != fileB.crcfull) {
-    //fprintf(stderr, "A: '%s' - full CRC %u - Valid %s\n", fileA.name.c_str(), fileA.crcfull.crc, fileA.crcfull.valid?"TRUE":"FALSE");
-    //fprintf(stderr, "B: '%s' - full CRC %u - Valid %s\n", fileB.name.c_str(), fileB.crcfull.crc, fileB.crcfull.valid?"TRUE":"FALSE");
-    return false;
+std::mutex progress_lock;
+
+/*
+ * A run of equal-sized paths in the sorted file order. Links to one
+ * (device, inode) are adjacent and form a single candidate: candidate
+ * i spans paths[starts[i]] to paths[starts[i+1]-1], its first path
+ * standing for the inode.
+ */
+struct size_bucket {
+  off_t size;
+  file_id *paths;
+  size_t count;
+  std::vector<uint32_t> starts;
+
+  size_t candidates() const {
+    return starts.size()-1;
   }
+  file_id leader(size_t i) const {
+    return paths[starts[i]];
+  }
+  bool has_links(size_t i) const {
+    return starts[i+1]-starts[i] > 1;
+  }
+};
 
-  if(byte_match(fileA, fileB)) return true;
-  return false;
+typedef std::vector<size_t> candidate_set;
+
+/*
+ * Split off the candidates whose data already lies in the same extents
+ * (reflinked copies, on btrfs or XFS) without reading them. Each group
+ * of those goes to sharing, its first member standing for the rest,
+ * and only that one is left in all to be read.
+ */
+void group_shared_extents(const size_bucket &bucket, candidate_set &all, std::vector<candidate_set> &sharing) {
+  std::map<std::pair<dev_t, std::vector<extent>>, size_t> by_extents;
+  std::vector<extent> extents;
+  for(size_t i=0; i<bucket.candidates(); i++) {
+    file_id id = bucket.leader(i);
+    if(!shared_extents(files.path(id), extents)) {
+      all.push_back(i);
+      continue;
+    }
+    auto found = by_extents.insert(std::make_pair(std::make_pair(files.device(id), extents), sharing.size()));
+    if(found.second) {
+      all.push_back(i);
+      sharing.push_back(candidate_set(1, i));
+    } else {
+      sharing[found.first->second].push_back(i);
+    }
+  }
+  sharing.erase(std::remove_if(sharing.begin(), sharing.end(), [](const candidate_set &group) { return group.size()<2; }), sharing.end());
 }
 
-void build_matches() {
-  size_t progress = 0;
+/* Bytes freed if all of a bucket's candidates turned out identical. */
+uint64_t reclaimable(const size_bucket &bucket) {
+  return (uint64_t)bucket.size * (bucket.candidates() - 1);
+}
 
-  std::map<off_t, std::deque<std::forward_list<file_t>>> next_filelist;
-  for(auto size_it=filelist.rbegin(); size_it!=filelist.rend(); ++size_it) {
-    if(size_it->second.size()<=1) {
-      progress += size_it->second.size();
-      continue;
+/* Whether --time-budget or --read-budget has run out. */
+bool budget_spent() {
+  return perf_stats::clock::now() >= deadline || (read_budget>0 && stats.bytes_read() >= read_budget);
+}
+
+/* Candidates held in sets, from the first'th set on. */
+size_t members(const std::vector<candidate_set> &sets, size_t first=0) {
+  size_t count = 0;
+  for(size_t i=first; i<sets.size(); i++) {
+    count += sets[i].size();
+  }
+  return count;
+}
+
+/* Refinement keeps every candidate of a set open at once. */
+#define REFINE_MAX_OPEN  (size_t)256
+
+/* Hash the given candidates, one task per file, queued by device. */
+template<typename HASH>
+void hash_candidates(thread_pool &pool, const size_bucket &bucket, const candidate_set &candidates, HASH hash) {
+  task_group tasks(pool);
+  for(auto it=candidates.begin(); it!=candidates.end(); ++it) {
+    file_id id = bucket.leader(*it);
+    io_queues.run(tasks, files.device(id), [id, hash]() { hash(id); });
+  }
+  tasks.wait();
+}
+
+/*
+ * Split candidates into sets sharing the same valid CRC. Sets keep the
+ * candidates' relative order; singletons can never match and are dropped.
+ */
+template<typename CRC>
+void split_by_crc(const size_bucket &bucket, const candidate_set &candidates, CRC crc, std::vector<candidate_set> &sets) {
+  std::unordered_map<uint32_t, candidate_set> by_crc;
+  for(auto it=candidates.begin(); it!=candidates.end(); ++it) {
+    class crc32 value = crc(bucket.leader(*it));
+    if(value.valid) by_crc[value.crc].push_back(*it);
+  }
+  for(auto it=by_crc.begin(); it!=by_crc.end(); ++it) {
+    if(it->second.size()>1) sets.push_back(std::move(it->second));
+  }
+}
+
+/*
+ * Split a set by the CRC of blocks sampled across its files, so that
+ * candidates sharing little more than a header part ways after a few
+ * KiB instead of a full read. Sets passed through untouched are those
+ * too small for sampling to pay, or whose full hashes are all known.
+ */
+void split_by_samples(thread_pool &pool, const size_bucket &bucket, candidate_set &candidates, std::vector<candidate_set> &sets) {
+  bool unknown = std::any_of(candidates.begin(), candidates.end(), [&bucket](size_t i) { return !full_hash_known(bucket.leader(i)); });
+  if(!sampler.applies(bucket.size) || !unknown) {
+    sets.push_back(std::move(candidates));
+    return;
+  }
+  hash_candidates(pool, bucket, candidates, [](file_id id) {
+    if(!files.crcsample(id).valid) gen_sample_crc(id);
+  });
+  size_t first = sets.size();
+  split_by_crc(bucket, candidates, [](file_id id) { return files.crcsample(id); }, sets);
+  stats.add_eliminated(STAGE_SAMPLE, candidates.size() - members(sets, first));
+}
+
+/* As split_by_crc, on the strong digest. */
+void split_by_digest(const size_bucket &bucket, const candidate_set &candidates, std::vector<candidate_set> &sets) {
+  std::map<digest_t, candidate_set> by_digest;
+  for(auto it=candidates.begin(); it!=candidates.end(); ++it) {
+    digest_t digest;
+    if(files.digest(bucket.leader(*it), digest)) by_digest[digest].push_back(*it);
+  }
+  for(auto it=by_digest.begin(); it!=by_digest.end(); ++it) {
+    if(it->second.size()>1) sets.push_back(std::move(it->second));
+  }
+}
+
+/*
+ * Split by full CRC, then byte compare candidates whose CRCs agree. A
+ * strong digest takes the CRC's place, and is proof enough on its own
+ * unless --verify asks for the comparison. That holds for digests from
+ * the cache too: a row is only used while the file's size, mtime and
+ * ctime are unchanged to the nanosecond.
+ */
+void confirm_by_hash(thread_pool &pool, const size_bucket &bucket, const candidate_set &candidates, std::vector<candidate_set> &identical) {
+  hash_candidates(pool, bucket, candidates, [](file_id id) {
+    if(!full_hash_known(id)) gen_full_hash(id);
+  });
+  std::vector<candidate_set> full_sets;
+  if(strong_hash!=DIGEST_NONE) {
+    split_by_digest(bucket, candidates, full_sets);
+  } else {
+    split_by_crc(bucket, candidates, [](file_id id) { return files.crcfull(id); }, full_sets);
+  }
+  stats.add_eliminated(STAGE_FULL, candidates.size() - members(full_sets));
+
+  /* FIDEDUPERANGE compares the contents itself, under lock. */
+  std::vector<candidate_set> unconfirmed;
+  for(auto full_it=full_sets.begin(); full_it!=full_sets.end(); ++full_it) {
+    if(!ISFLAG(flags, F_VERIFY) && (ISFLAG(flags, F_DEDUPE) || strong_hash!=DIGEST_NONE)) {
+      identical.push_back(std::move(*full_it));
+    } else {
+      unconfirmed.push_back(std::move(*full_it));
     }
+  }
 
-    //fprintf(stderr, "\r%40sSize: %zu Groups: %zu%40s", "", size_it->first, size_it->second.size(), "");
-    // Populate queue
-    std::deque<std::forward_list<file_t>> queue;
-    for(auto grp_it=size_it->second.begin(); grp_it!=size_it->second.end(); ++grp_it) {
-      queue.push_back(*grp_it);
+  /* Equal CRCs are almost always equal files; confirm against the
+   * first member of each set found so far. */
+  size_t first = identical.size();
+  for(auto full_it=unconfirmed.begin(); full_it!=unconfirmed.end(); ++full_it) {
+    std::vector<candidate_set> confirmed;
+    for(auto it=full_it->begin(); it!=full_it->end(); ++it) {
+      auto set = confirmed.begin();
+      for(; set!=confirmed.end(); ++set) {
+        if(byte_match(bucket.leader(set->front()), bucket.leader(*it))) break;
+      }
+      if(set==confirmed.end()) {
+        confirmed.push_back(candidate_set(1, *it));
+      } else {
+        set->push_back(*it);
+      }
     }
+    for(auto set=confirmed.begin(); set!=confirmed.end(); ++set) {
+      if(set->size()>1) identical.push_back(std::move(*set));
+    }
+  }
+  stats.add_eliminated(STAGE_COMPARE, members(unconfirmed) - members(identical, first));
+}
+
+struct refine_member {
+  size_t index;
+  std::unique_ptr<file_reader> reader;
+  uint32_t crc;
+  bool ok;
+  const unsigned char *data;
+};
+
+/*
+ * Single pass refinement: read all candidates side by side, chunk by
+ * chunk, and split the set as soon as their contents diverge. Every
+ * byte of every file is read at most once; members left on their own
+ * are closed straight away. The running CRC doubles as the full CRC.
+ */
+void refine_candidates(thread_pool &pool, const size_bucket &bucket, const candidate_set &candidates, std::vector<candidate_set> &identical) {
+  off_t size = bucket.size;
+  std::vector<refine_member> members(candidates.size());
+  std::vector<std::vector<refine_member *>> active(1);
+  for(size_t i=0; i<candidates.size(); i++) {
+    refine_member &member = members[i];
+    member.index = candidates[i];
+    member.reader.reset(file_reader::open(files.path(bucket.leader(member.index)), size, io_backend));
+    member.crc = 0;
+    member.ok = (bool)member.reader;
+    if(member.ok) active[0].push_back(&member);
+  }
 
-    while(queue.size()>0) {
-      auto grp_A_it = queue.begin();
-      std::deque<std::forward_list<file_t>> next_queue;
-      std::forward_list<file_t> cur_group = *grp_A_it;
-      for(auto grp_B_it=grp_A_it+1; grp_B_it!=queue.end(); ++grp_B_it) {
-        if(groups_match(cur_group, *grp_B_it)) {
-          cur_group.insert_after ( cur_group.before_begin(), grp_B_it->begin(), grp_B_it->end() );
-          progress++;
+  /* start with partial-sized chunks: most candidates differ early */
+  off_t chunk = MAX_PARTIAL_SIZE;
+  for(off_t offset=0; offset<size && !active.empty(); offset+=chunk, chunk=std::min(chunk*2, (off_t)READ_BLOCK)) {
+    size_t length = std::min(chunk, size-offset);
+    perf_stage stage = offset==0 ? STAGE_PARTIAL : STAGE_FULL;
+    /* files are counted at their first read of each stage */
+    uint64_t opened = offset==0 || offset==MAX_PARTIAL_SIZE ? 1 : 0;
+    {
+      task_group tasks(pool);
+      for(auto grp_it=active.begin(); grp_it!=active.end(); ++grp_it) {
+        for(auto it=grp_it->begin(); it!=grp_it->end(); ++it) {
+          refine_member *member = *it;
+          io_queues.run(tasks, files.device(bucket.leader(member->index)), [member, length, stage, opened]() {
+            stage_timer timer(stage);
+            member->ok = member->reader->next(member->data, length)==(ssize_t)length;
+            bool hole = member->ok && member->reader->in_hole();
+            if(member->ok) member->crc = hole ? crc32_zeros(member->crc, length) : crc32(member->crc, member->data, length);
+            stats.add_read(stage, member->ok && !hole ? length : 0, opened);
+          });
+        }
+      }
+      tasks.wait();
+    }
+    if(offset==0) {
+      for(auto grp_it=active.begin(); grp_it!=active.end(); ++grp_it) {
+        for(auto it=grp_it->begin(); it!=grp_it->end(); ++it) {
+          if((*it)->ok) files.set_crcpartial(bucket.leader((*it)->index), (*it)->crc);
+        }
+      }
+    }
+
+    /* Split each set on the running CRC, confirming with memcmp. */
+    std::vector<std::vector<refine_member *>> next_active;
+    size_t before = 0, after = 0;
+    for(auto grp_it=active.begin(); grp_it!=active.end(); ++grp_it) {
+      before += grp_it->size();
+      std::unordered_map<uint32_t, std::vector<size_t>> by_crc;
+      std::vector<std::vector<refine_member *>> split;
+      for(auto it=grp_it->begin(); it!=grp_it->end(); ++it) {
+        refine_member *member = *it;
+        if(!member->ok) continue;
+        std::vector<size_t> &same_crc = by_crc[member->crc];
+        auto sub = same_crc.begin();
+        for(; sub!=same_crc.end(); ++sub) {
+          if(split[*sub].front()->data==member->data || memcmp(split[*sub].front()->data, member->data, length)==0) break;
+        }
+        if(sub==same_crc.end()) {
+          same_crc.push_back(split.size());
+          split.push_back(std::vector<refine_member *>(1, member));
         } else {
-          next_queue.push_back(*grp_B_it);
+          split[*sub].push_back(member);
         }
       }
-      if (!ISFLAG(flags, F_HIDEPROGRESS)) {
-        fprintf(stderr, "\rProgress [%zu/%zu] (size %zu) %d%% ", progress, filecount, size_it->first, (int)((float) progress / (float) filecount * 100.0));
-        progress++;
+      for(auto sub=split.begin(); sub!=split.end(); ++sub) {
+        if(sub->size()>1) {
+          after += sub->size();
+          next_active.push_back(std::move(*sub));
+        } else {
+          sub->front()->reader.reset();
+        }
+      }
+    }
+    stats.add_eliminated(stage, before - after);
+    active.swap(next_active);
+  }
+
+  for(auto grp_it=active.begin(); grp_it!=active.end(); ++grp_it) {
+    candidate_set set;
+    for(auto it=grp_it->begin(); it!=grp_it->end(); ++it) {
+      files.set_crcfull(bucket.leader((*it)->index), (*it)->crc);
+      set.push_back((*it)->index);
+    }
+    identical.push_back(set);
+  }
+}
+
+/*
+ * Make the links to each (device, inode) in a bucket adjacent and mark
+ * where each candidate starts, so that every physical file is read once
+ * however many links point at it. The first path in bucket order stays
+ * in front and represents the inode; candidates keep that order too.
+ */
+void collapse_hardlinks(size_bucket &bucket) {
+  std::vector<file_id> by_inode(bucket.paths, bucket.paths + bucket.count);
+  std::stable_sort(by_inode.begin(), by_inode.end(), [](file_id a, file_id b) {
+    return std::make_pair(files.device(a), files.inode(a)) < std::make_pair(files.device(b), files.inode(b));
+  });
+
+  /* runs of links, by position of their first path in the bucket */
+  std::vector<std::pair<size_t, size_t>> runs;
+  for(size_t begin=0, end; begin<by_inode.size(); begin=end) {
+    for(end=begin+1; end<by_inode.size() && files.device(by_inode[end])==files.device(by_inode[begin]) && files.inode(by_inode[end])==files.inode(by_inode[begin]); end++);
+    /* later links follow the first path in the order they were found */
+    std::reverse(by_inode.begin()+begin+1, by_inode.begin()+end);
+    runs.push_back(std::make_pair(begin, end));
+  }
+  std::sort(runs.begin(), runs.end(), [&by_inode](const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b) {
+    return by_inode[a.first] > by_inode[b.first];
+  });
+
+  bucket.starts.clear();
+  file_id *out = bucket.paths;
+  for(auto it=runs.begin(); it!=runs.end(); ++it) {
+    bucket.starts.push_back(out - bucket.paths);
+    out = std::copy(by_inode.begin()+it->first, by_inode.begin()+it->second, out);
+  }
+  bucket.starts.push_back(bucket.count);
+}
+
+/* Which checksums the cache supplied, per candidate of a bucket. */
+typedef std::vector<unsigned int> cache_state;
+
+unsigned int hash_state(file_id id) {
+  digest_t digest;
+  return (files.crcpartial(id).valid ? 0x1 : 0) | (files.crcfull(id).valid ? 0x2 : 0) | (files.digest(id, digest) ? 0x4 : 0);
+}
+
+void lookup_cached(const size_bucket &bucket, cache_state &known) {
+  for(size_t i=0; i<bucket.candidates(); i++) {
+    file_id id = bucket.leader(i);
+    cache.lookup(files, id);
+    known.push_back(hash_state(id));
+  }
+}
+
+/* Candidates of non-empty buckets still lacking a partial CRC. */
+void partial_pending(const std::vector<size_bucket> &buckets, std::vector<file_id> &ids) {
+  for(auto it=buckets.begin(); it!=buckets.end(); ++it) {
+    if(it->size==0) continue;
+    for(size_t i=0; i<it->candidates(); i++) {
+      if(!files.crcpartial(it->leader(i)).valid) ids.push_back(it->leader(i));
+    }
+  }
+}
+
+/*
+ * What a candidate is known to share with others before a full read:
+ * its partial CRC, plus its sampled CRC if sampled is set. False while
+ * either is missing.
+ */
+bool prefix_key(file_id id, bool sampled, uint64_t &key) {
+  class crc32 crcpartial = files.crcpartial(id);
+  class crc32 crcsample = files.crcsample(id);
+  if(!crcpartial.valid || (sampled && !crcsample.valid)) return false;
+  key = (uint64_t)crcpartial.crc << 32 | (sampled ? crcsample.crc : 0);
+  return true;
+}
+
+/*
+ * Candidates up to max_size lacking a full hash whose prefix key is
+ * shared; with samples set, those lacking a sample whose partial CRC
+ * is shared instead.
+ */
+void shared_pending(const std::vector<size_bucket> &buckets, off_t max_size, bool samples, std::vector<file_id> &ids) {
+  for(auto it=buckets.begin(); it!=buckets.end(); ++it) {
+    if(it->size<=MAX_PARTIAL_SIZE || it->size>max_size) continue;
+    bool sampled = sampler.applies(it->size);
+    if(samples && !sampled) continue;
+    std::unordered_map<uint64_t, size_t> key_count;
+    for(size_t i=0; i<it->candidates(); i++) {
+      uint64_t key;
+      if(prefix_key(it->leader(i), sampled && !samples, key)) key_count[key]++;
+    }
+    for(size_t i=0; i<it->candidates(); i++) {
+      file_id id = it->leader(i);
+      uint64_t key;
+      if(!prefix_key(id, sampled && !samples, key) || full_hash_known(id) || key_count[key]<2) continue;
+      if(samples && files.crcsample(id).valid) continue;
+      ids.push_back(id);
+    }
+  }
+}
+
+void full_pending(const std::vector<size_bucket> &buckets, off_t max_size, std::vector<file_id> &ids) {
+  shared_pending(buckets, max_size, false, ids);
+}
+
+void sample_pending(const std::vector<size_bucket> &buckets, std::vector<file_id> &ids) {
+  shared_pending(buckets, std::numeric_limits<off_t>::max(), true, ids);
+}
+
+/*
+ * Checksum small reads ahead of the buckets through io_uring: first the
+ * partial CRC of every candidate, then the full CRC of small files whose
+ * partial CRC is shared, unless a strong digest is to decide matches
+ * instead. Anything left invalid is retried by the regular
+ * per-bucket path, which is also all that runs without io_uring.
+ */
+void prehash_uring(const std::vector<size_bucket> &buckets) {
+  uring_reader ring(uring_depth);
+  if(!ring.available()) {
+    errormsg("io_uring is unavailable, reading with threads instead\n");
+    return;
+  }
+
+  std::vector<file_id> ids;
+  partial_pending(buckets, ids);
+  std::vector<std::string> paths;
+  std::vector<checksum_job> jobs;
+  for(auto it=ids.begin(); it!=ids.end(); ++it) {
+    paths.push_back(files.path(*it));
+  }
+  for(size_t i=0; i<ids.size(); i++) {
+    jobs.push_back(checksum_job(paths[i].c_str(), std::min(files.size(ids[i]), MAX_PARTIAL_SIZE)));
+  }
+  ring.checksum(jobs);
+  for(size_t i=0; i<jobs.size(); i++) {
+    if(!jobs[i].ok) continue;
+    stats.add_read(STAGE_PARTIAL, std::min(files.size(ids[i]), MAX_PARTIAL_SIZE));
+    files.set_crcpartial(ids[i], jobs[i].crc);
+    if(files.size(ids[i]) <= MAX_PARTIAL_SIZE) files.set_crcfull(ids[i], jobs[i].crc);
+  }
+
+  if(strong_hash!=DIGEST_NONE) return;
+  ids.clear();
+  paths.clear();
+  jobs.clear();
+  full_pending(buckets, URING_MAX_READ, ids);
+  for(auto it=ids.begin(); it!=ids.end(); ++it) {
+    paths.push_back(files.path(*it));
+  }
+  for(size_t i=0; i<ids.size(); i++) {
+    jobs.push_back(checksum_job(paths[i].c_str(), files.size(ids[i])));
+  }
+  ring.checksum(jobs);
+  for(size_t i=0; i<jobs.size(); i++) {
+    if(!jobs[i].ok) continue;
+    stats.add_read(STAGE_FULL, files.size(ids[i]));
+    files.set_crcfull(ids[i], jobs[i].crc);
+  }
+}
+
+struct placed_file {
+  dev_t device;
+  uint64_t physical;
+  file_id id;
+};
+
+/*
+ * Hash files in the order their data lies on disk: sorted by device,
+ * then by first extent, with files of unknown layout last. Each device
+ * is one task reading its files one after another, so a spinning disk
+ * sweeps across the platter instead of seeking between buckets.
+ */
+template<typename HASH>
+void hash_physical(thread_pool &pool, const std::vector<file_id> &ids, HASH hash) {
+  std::vector<placed_file> placed(ids.size());
+  for(size_t i=0; i<ids.size(); i++) {
+    placed[i].device = files.device(ids[i]);
+    placed[i].id = ids[i];
+    if(!first_extent(files.path(ids[i]), placed[i].physical)) placed[i].physical = UINT64_MAX;
+  }
+  std::sort(placed.begin(), placed.end(), [](const placed_file &a, const placed_file &b) {
+    if(a.device!=b.device) return a.device < b.device;
+    if(a.physical!=b.physical) return a.physical < b.physical;
+    return a.id < b.id;
+  });
+
+  task_group tasks(pool);
+  for(size_t begin=0, end; begin<placed.size(); begin=end) {
+    for(end=begin+1; end<placed.size() && placed[end].device==placed[begin].device; end++);
+    const placed_file *first = placed.data() + begin, *last = placed.data() + end;
+    tasks.run([first, last, hash]() {
+      for(const placed_file *it=first; it!=last; ++it) {
+        hash(it->id);
+      }
+    });
+  }
+  tasks.wait();
+}
+
+/* Partial CRCs, samples, then full hashes, in physical order per device. */
+void prehash_physical(thread_pool &pool, const std::vector<size_bucket> &buckets) {
+  std::vector<file_id> ids;
+  partial_pending(buckets, ids);
+  hash_physical(pool, ids, [](file_id id) { gen_partial_crc(id); });
+
+  ids.clear();
+  sample_pending(buckets, ids);
+  hash_physical(pool, ids, [](file_id id) { gen_sample_crc(id); });
+
+  ids.clear();
+  full_pending(buckets, std::numeric_limits<off_t>::max(), ids);
+  hash_physical(pool, ids, [](file_id id) { gen_full_hash(id); });
+}
+
+/* Open a JSON object with the path, in hex if it is not valid UTF-8. */
+void append_json_path(std::string &line, const std::string &path) {
+  if(json_valid_utf8(path)) {
+    line += "{\"path\":";
+    json_append_string(line, path);
+  } else {
+    line += "{\"path_hex\":";
+    json_append_hex(line, (const unsigned char *)path.data(), path.length());
+  }
+}
+
+/*
+ * Write one duplicate set as a line of JSON straight away, so that
+ * consumers can act on it while later buckets are still being read.
+ * Hashes are those recorded for the first member that has them (extra
+ * hard links never do); paths that are not valid UTF-8 are given in
+ * hex as path_hex instead. Files found to be reflinked copies
+ * (--reflinks=report) carry "reflinked":true.
+ */
+void print_ndjson(const match_set &set) {
+  std::string line = "{\"size\":" + std::to_string((long long)files.size(set.front()));
+  auto crc_it = std::find_if(set.begin(), set.end(), [](file_id id) { return files.crcfull(id).valid; });
+  if(crc_it!=set.end()) {
+    char hex[16];
+    snprintf(hex, sizeof(hex), "%08x", files.crcfull(*crc_it).crc);
+    line += std::string(",\"crc32\":\"") + hex + "\"";
+  }
+  digest_t digest;
+  auto digest_it = std::find_if(set.begin(), set.end(), [&digest](file_id id) { return files.digest(id, digest); });
+  if(strong_hash!=DIGEST_NONE && digest_it!=set.end()) {
+    line += std::string(",\"") + digest_context::kind_name(strong_hash) + "\":";
+    json_append_hex(line, digest.bytes, DIGEST_SIZE);
+  }
+  line += ",\"files\":[";
+  for(auto it=set.begin(); it!=set.end(); ++it) {
+    if(it!=set.begin()) line += ",";
+    append_json_path(line, files.path(*it));
+    line += ",\"device\":" + std::to_string((unsigned long long)files.device(*it));
+    line += ",\"inode\":" + std::to_string((unsigned long long)files.inode(*it));
+    if(files.shared_extents(*it)) line += ",\"reflinked\":true";
+    line += files.read_only(*it) ? ",\"read_only\":true}" : ",\"read_only\":false}";
+  }
+  line += "]}\n";
+
+  std::lock_guard<std::mutex> guard(output_lock);
+  fputs(line.c_str(), stdout);
+  fflush(stdout);
+}
+
+/*
+ * Resolve one size bucket: split by partial CRC, then by full CRC, and
+ * only byte compare candidates whose digests agree. Each file is hashed
+ * at most once, so the cost is linear in the size of the bucket.
+ */
+void match_bucket(thread_pool &pool, const size_bucket &bucket, const cache_state &known, std::vector<match_set> &matched, std::atomic<size_t> &progress) {
+  candidate_set all;
+  std::vector<candidate_set> sharing;
+  if(reflinks!=REFLINKS_READ && bucket.size>0) {
+    group_shared_extents(bucket, all, sharing);
+  } else {
+    for(size_t i=0; i<bucket.candidates(); i++) {
+      all.push_back(i);
+    }
+  }
+
+  std::vector<candidate_set> identical;
+  if(bucket.size==0) {
+    identical.push_back(all);
+  } else if(ISFLAG(flags, F_REFINE) && all.size()<=REFINE_MAX_OPEN) {
+    refine_candidates(pool, bucket, all, identical);
+  } else {
+    hash_candidates(pool, bucket, all, [](file_id id) {
+      if(!files.crcpartial(id).valid) gen_partial_crc(id);
+    });
+    std::vector<candidate_set> partial_sets;
+    split_by_crc(bucket, all, [](file_id id) { return files.crcpartial(id); }, partial_sets);
+    stats.add_eliminated(STAGE_PARTIAL, all.size() - members(partial_sets));
+
+    std::vector<candidate_set> sampled_sets;
+    for(auto set_it=partial_sets.begin(); set_it!=partial_sets.end(); ++set_it) {
+      split_by_samples(pool, bucket, *set_it, sampled_sets);
+    }
+
+    for(auto set_it=sampled_sets.begin(); set_it!=sampled_sets.end(); ++set_it) {
+      if(ISFLAG(flags, F_REFINE) && set_it->size()<=REFINE_MAX_OPEN) {
+        refine_candidates(pool, bucket, *set_it, identical);
+      } else {
+        confirm_by_hash(pool, bucket, *set_it, identical);
+      }
+    }
+  }
+
+  for(size_t i=0; i<known.size(); i++) {
+    file_id id = bucket.leader(i);
+    if(known[i]!=hash_state(id)) cache.store(files, id);
+  }
+
+  /* reflinked copies rejoin the set their first member ended up in */
+  if(reflinks==REFLINKS_REPORT) {
+    for(auto group=sharing.begin(); group!=sharing.end(); ++group) {
+      auto set = std::find_if(identical.begin(), identical.end(), [&group](const candidate_set &candidates) {
+        return std::find(candidates.begin(), candidates.end(), group->front())!=candidates.end();
+      });
+      if(set==identical.end()) set = identical.insert(identical.end(), candidate_set(1, group->front()));
+      set->insert(set->end(), group->begin()+1, group->end());
+      std::sort(set->begin(), set->end());
+      for(auto it=group->begin(); it!=group->end(); ++it) {
+        files.set_shared_extents(bucket.leader(*it));
       }
-      size_t cg_size = 0;
-      for(auto cg_it=cur_group.begin(); cg_it!=cur_group.end(); ++cg_it) {
-        cg_size++;
+    }
+  }
+
+  /* Hard links to one inode were matched as a single candidate. With
+   * -H they are duplicates of each other, otherwise only the first path
+   * found stands for the inode. */
+  bool hardlinks = ISFLAG(flags, F_CONSIDERHARDLINKS);
+  std::vector<bool> reported(bucket.candidates(), false);
+  std::vector<candidate_set> reportable;
+  for(auto set=identical.begin(); set!=identical.end(); ++set) {
+    if(set->size()>1 || (hardlinks && bucket.has_links(set->front()))) {
+      for(auto it=set->begin(); it!=set->end(); ++it) {
+        reported[*it] = true;
       }
-      if(cg_size>1) {
-        next_filelist[size_it->first].push_back(cur_group);
+      reportable.push_back(std::move(*set));
+    }
+  }
+  if(hardlinks) {
+    for(size_t i=0; i<bucket.candidates(); i++) {
+      if(!reported[i] && bucket.has_links(i)) reportable.push_back(candidate_set(1, i));
+    }
+  }
+
+  /* Report sets in the order the pairwise queue used to produce them:
+   * ordered by first member, later members first within each set. */
+  std::sort(reportable.begin(), reportable.end(), [](const candidate_set &a, const candidate_set &b) {
+    return a.front() < b.front();
+  });
+  for(auto set=reportable.begin(); set!=reportable.end(); ++set) {
+    match_set cur_group;
+    for(auto it=set->rbegin(); it!=set->rend(); ++it) {
+      size_t last = hardlinks ? bucket.starts[*it+1] : bucket.starts[*it]+1;
+      cur_group.insert(cur_group.end(), bucket.paths + bucket.starts[*it], bucket.paths + last);
+    }
+    matched.push_back(std::move(cur_group));
+  }
+
+  progress += bucket.count;
+  if (!ISFLAG(flags, F_HIDEPROGRESS)) {
+    std::lock_guard<std::mutex> guard(progress_lock);
+    fprintf(stderr, "\rProgress [%zu/%zu] (size %zu) %d%% ", progress.load(), filecount, bucket.size, (int)((float) progress / (float) filecount * 100.0));
+  }
+}
+
+void build_matches() {
+  std::atomic<size_t> progress(0);
+  auto group_start = perf_stats::clock::now();
+
+  /* Largest files first; equal sizes latest found first, the order in
+   * which sets have always been reported. */
+  std::vector<file_id> order(files.count());
+  for(file_id id=0; id<order.size(); id++) {
+    order[id] = id;
+  }
+  std::sort(order.begin(), order.end(), [](file_id a, file_id b) {
+    if(files.size(a)!=files.size(b)) return files.size(a) > files.size(b);
+    return a > b;
+  });
+
+  std::vector<size_bucket> buckets;
+  for(size_t begin=0, end; begin<order.size(); begin=end) {
+    off_t size = files.size(order[begin]);
+    for(end=begin+1; end<order.size() && files.size(order[end])==size; end++);
+    if(end-begin<=1) {
+      progress += end-begin;
+      stats.add_eliminated(STAGE_SIZE, end-begin);
+      continue;
+    }
+    size_bucket bucket;
+    bucket.size = size;
+    bucket.paths = &order[begin];
+    bucket.count = end-begin;
+    collapse_hardlinks(bucket);
+    if(bucket.candidates()<=1 && !ISFLAG(flags, F_CONSIDERHARDLINKS)) {
+      progress += bucket.count;
+      stats.add_eliminated(STAGE_SIZE, bucket.count);
+      continue;
+    }
+    buckets.push_back(std::move(bucket));
+  }
+  if(savings_first) {
+    std::stable_sort(buckets.begin(), buckets.end(), [](const size_bucket &a, const size_bucket &b) {
+      return reclaimable(a) > reclaimable(b);
+    });
+  }
+
+  /* remember what the cache already knew, to write back only news */
+  std::vector<cache_state> known(buckets.size());
+  if(cache.is_open()) {
+    for(size_t i=0; i<buckets.size(); i++) {
+      if(buckets[i].size>0) lookup_cached(buckets[i], known[i]);
+    }
+  }
+  stats.add_phase(PHASE_GROUP, perf_stats::clock::now() - group_start);
+
+  thread_pool pool(num_threads);
+  if(!ISFLAG(flags, F_REFINE)) {
+    phase_timer timer(PHASE_PREHASH);
+    if(uring_depth>0) prehash_uring(buckets);
+    if(ISFLAG(flags, F_PHYSORDER)) prehash_physical(pool, buckets);
+  }
+
+  /* Buckets are independent; results are collected per bucket and
+   * merged in order afterwards, so output matches a serial run. */
+  std::vector<std::vector<match_set>> matched(buckets.size());
+  /* with nothing to act on afterwards, savings first listings stream too */
+  bool stream = !trees && (output==OUTPUT_NDJSON || (savings_first && !ISFLAG(flags, F_DELETEFILES) && !ISFLAG(flags, F_DEDUPE)));
+  auto resolve = [&pool, &progress, &buckets, &known, &matched, stream](size_t i) {
+    match_bucket(pool, buckets[i], known[i], matched[i], progress);
+    /* streamed as soon as the bucket is resolved */
+    if(stream && output==OUTPUT_NDJSON) {
+      std::for_each(matched[i].begin(), matched[i].end(), print_ndjson);
+    } else if(stream) {
+      std::lock_guard<std::mutex> guard(output_lock);
+      std::for_each(matched[i].begin(), matched[i].end(), print_set);
+      fflush(stdout);
+    }
+    if(stream) matched[i].clear();
+  };
+  {
+    phase_timer timer(PHASE_MATCH);
+    task_group tasks(pool);
+    if(savings_first) {
+      /* every thread takes the next bucket in order until the budget
+       * is spent; buckets already started are finished */
+      std::atomic<size_t> next(0);
+      std::vector<char> checked(buckets.size(), false);
+      for(unsigned int t=0; t<pool.size(); t++) {
+        tasks.run([&next, &checked, &buckets, &resolve]() {
+          for(size_t i; (i = next++)<buckets.size() && !budget_spent(); ) {
+            resolve(i);
+            checked[i] = true;
+          }
+        });
+      }
+      tasks.wait();
+
+      size_t unchecked = 0;
+      uint64_t unchecked_bytes = 0;
+      for(size_t i=0; i<buckets.size(); i++) {
+        if(checked[i]) continue;
+        unchecked++;
+        unchecked_bytes += reclaimable(buckets[i]);
       }
-      queue = next_queue;
+      if(unchecked>0) {
+        errormsg("budget spent: %zu of %zu groups of equal-sized files left unchecked, holding up to %.1f reclaimable megabytes\n",
+            unchecked, buckets.size(), unchecked_bytes / (1024.0 * 1024.0));
+      }
+    } else {
+      for(size_t i=0; i<buckets.size(); i++) {
+        tasks.run([&resolve, i]() {
+          resolve(i);
+        });
+      }
+      tasks.wait();
     }
   }
+
+  for(size_t i=0; i<buckets.size(); i++) {
+    std::move(matched[i].begin(), matched[i].end(), std::back_inserter(matches));
+  }
   if (!ISFLAG(flags, F_HIDEPROGRESS)) fprintf(stderr, "\r%40s\r", " ");
-  filelist = next_filelist;
 }
 
-void dump_filelist() {
-  off_t group_id = 0;
-  for(auto size_it=filelist.rbegin(); size_it!=filelist.rend(); ++size_it) {
-    for(auto grp_it=size_it->second.begin(); grp_it!=size_it->second.end(); ++grp_it) {
-      group_id++;
-      for(auto file_it=grp_it->begin(); file_it!=grp_it->end(); ++file_it) {
-        fprintf( stderr, "\n%zu\t'%s'\t%zu", group_id, file_it->name.c_str(), file_it->size );
+/*
+ * --trees: directories whose scanned contents are identical, names and
+ * all, reported as one set instead of a set per file. Each directory
+ * gets a class from the sorted names and classes of its children, bottom
+ * up, much as a Merkle tree hashes its nodes; classes are interned
+ * rather than hashed, so equal classes are never a collision. Files
+ * take the class of their duplicate set, or one of their own.
+ */
+struct tree_set {
+  std::vector<dir_id> dirs;
+  size_t files;
+  uint64_t bytes;
+};
+
+void print_tree(const tree_set &set) {
+  if(output==OUTPUT_NDJSON) {
+    std::string line = "{\"tree\":true,\"files\":" + std::to_string((unsigned long long)set.files);
+    line += ",\"size\":" + std::to_string((unsigned long long)set.bytes) + ",\"directories\":[";
+    for(auto it=set.dirs.begin(); it!=set.dirs.end(); ++it) {
+      if(it!=set.dirs.begin()) line += ",";
+      append_json_path(line, files.directory_path(*it));
+      line += files.directory_read_only(*it) ? ",\"read_only\":true}" : ",\"read_only\":false}";
+    }
+    line += "]}\n";
+    fputs(line.c_str(), stdout);
+    return;
+  }
+  if (ISFLAG(flags, F_SHOWSIZE)) printf("%zu file%s, %llu bytes in each:\n", set.files, set.files!=1 ? "s" : "", (unsigned long long)set.bytes);
+  for(auto it=set.dirs.begin(); it!=set.dirs.end(); ++it) {
+    std::string path = files.directory_path(*it);
+    if(path.empty() || path[path.length()-1] != '/') path.push_back('/');
+    printf("%s (%c)%c", path.c_str(), files.directory_read_only(*it) ? 'R' : 'W', ISFLAG(flags, F_DSAMELINE)?' ':'\n');
+  }
+  printf("\n");
+}
+
+void print_trees() {
+  /* duplicate sets first, then every other file, get a class each */
+  std::vector<size_t> content(files.count(), matches.size());
+  for(size_t set=0; set<matches.size(); set++) {
+    for(auto it=matches[set].begin(); it!=matches[set].end(); ++it) {
+      content[*it] = set;
+    }
+  }
+  size_t classes = matches.size();
+  for(file_id id=0; id<files.count(); id++) {
+    if(content[id]==matches.size()) content[id] = classes++;
+  }
+
+  /* children by name; a directory is always added after its parent */
+  size_t directories = files.directories();
+  std::vector<std::vector<std::pair<std::string, std::string>>> children(directories);
+  auto add_child = [&children](dir_id parent, const char *name, char kind, size_t child_class) {
+    std::string key(1, kind);
+    key.append((const char *)&child_class, sizeof(child_class));
+    children[parent].push_back(std::make_pair(std::string(name), key));
+  };
+  std::vector<size_t> tree_files(directories, 0);
+  std::vector<uint64_t> tree_bytes(directories, 0);
+  for(file_id id=0; id<files.count(); id++) {
+    add_child(files.directory(id), files.leaf(id), 'f', content[id]);
+    tree_files[files.directory(id)]++;
+    tree_bytes[files.directory(id)] += files.size(id);
+  }
+
+  std::unordered_map<std::string, size_t> interned;
+  std::vector<size_t> dir_class(directories);
+  for(dir_id dir=directories; dir-- > 0; ) {
+    std::sort(children[dir].begin(), children[dir].end());
+    std::string key;
+    for(auto it=children[dir].begin(); it!=children[dir].end(); ++it) {
+      key += it->first;
+      key.push_back('\0');
+      key += it->second;
+    }
+    children[dir].clear();
+    dir_class[dir] = interned.insert(std::make_pair(key, interned.size())).first->second;
+    dir_id parent = files.parent_directory(dir);
+    if(parent==NO_PARENT) continue;
+    /* the name of a directory is its path relative to its parent */
+    std::string path = files.directory_path(dir);
+    add_child(parent, path.c_str() + path.rfind('/') + 1, 'd', dir_class[dir]);
+    tree_files[parent] += tree_files[dir];
+    tree_bytes[parent] += tree_bytes[dir];
+  }
+
+  /* directories with files, grouped by class in walk order */
+  std::map<size_t, std::vector<dir_id>> by_class;
+  for(dir_id dir=0; dir<directories; dir++) {
+    if(tree_files[dir]>0) by_class[dir_class[dir]].push_back(dir);
+  }
+  auto leaf_name = [](dir_id dir) {
+    std::string path = files.directory_path(dir);
+    return path.substr(path.rfind('/') + 1);
+  };
+
+  /* a set is left to its parents' set when it is the same child of each
+   * of them, which only holds if the parents are all of one class */
+  std::vector<tree_set> sets;
+  for(auto it=by_class.begin(); it!=by_class.end(); ++it) {
+    if(it->second.size()<2) continue;
+    dir_id parent = files.parent_directory(it->second.front());
+    bool implied = parent!=NO_PARENT;
+    std::string name = implied ? leaf_name(it->second.front()) : std::string();
+    for(auto dir=it->second.begin(); implied && dir!=it->second.end(); ++dir) {
+      dir_id other = files.parent_directory(*dir);
+      implied = other!=NO_PARENT && dir_class[other]==dir_class[parent] && leaf_name(*dir)==name;
+    }
+    if(implied) continue;
+    sets.push_back(tree_set{it->second, tree_files[it->second.front()], tree_bytes[it->second.front()]});
+  }
+  std::stable_sort(sets.begin(), sets.end(), [](const tree_set &a, const tree_set &b) {
+    if(a.bytes!=b.bytes) return a.bytes > b.bytes;
+    return a.dirs.front() < b.dirs.front();
+  });
+  std::for_each(sets.begin(), sets.end(), print_tree);
+
+  /* each directory's innermost reported tree, and the member it is in */
+  std::vector<size_t> tree(directories, sets.size());
+  std::vector<dir_id> tree_root(directories, NO_PARENT);
+  for(size_t i=0; i<sets.size(); i++) {
+    for(auto dir=sets[i].dirs.begin(); dir!=sets[i].dirs.end(); ++dir) {
+      tree[*dir] = i;
+      tree_root[*dir] = *dir;
+    }
+  }
+  for(dir_id dir=0; dir<directories; dir++) {
+    dir_id parent = files.parent_directory(dir);
+    if(tree[dir]!=sets.size() || parent==NO_PARENT) continue;
+    tree[dir] = tree[parent];
+    tree_root[dir] = tree_root[parent];
+  }
+  auto within_tree = [&tree_root](file_id id) {
+    return files.path(id).substr(files.directory_path(tree_root[files.directory(id)]).length());
+  };
+
+  /* then the file sets no reported tree accounts for: one is left out
+   * only if it is the same file of every member of one tree set */
+  for(auto set=matches.begin(); set!=matches.end(); ++set) {
+    size_t in_tree = tree[files.directory(set->front())];
+    bool implied = in_tree!=sets.size() && std::all_of(set->begin(), set->end(), [&tree, in_tree](file_id id) {
+      return tree[files.directory(id)]==in_tree;
+    });
+    if(implied) {
+      std::string relative = within_tree(set->front());
+      implied = std::all_of(set->begin(), set->end(), [&within_tree, &relative](file_id id) { return within_tree(id)==relative; });
+    }
+    if(implied) continue;
+    if(output==OUTPUT_NDJSON) {
+      print_ndjson(*set);
+    } else {
+      print_set(*set);
+    }
+  }
+}
+
+/* Quiet time after the last event before affected buckets are matched. */
+#define WATCH_SETTLE_MS 500
+/* Longest a burst of events may hold matching back. */
+#define WATCH_MAX_DELAY_MS 5000
+/* Dead records of either kind tolerated before compacting, at least. */
+#define WATCH_COMPACT_MIN (size_t)4096
+
+/*
+ * The live files of the watched tree, by size and by directory. Files
+ * that change are added to the store again under a new id, and the old
+ * record is dropped from the index; once dead records outnumber live
+ * ones the store is compacted and the index renumbered.
+ */
+struct watch_index {
+  watch_index(): roots(), by_size(), dir_files(), dir_children(), dir_live(), live_files(0), live_dirs(0) {}
+  std::vector<std::string> roots;
+  std::unordered_map<off_t, std::vector<file_id>> by_size;
+  std::vector<std::vector<file_id>> dir_files;
+  std::vector<std::vector<dir_id>> dir_children;
+  std::vector<bool> dir_live;
+  size_t live_files;
+  size_t live_dirs;
+};
+
+std::string entry_path(dir_id dir, const std::string &name) {
+  std::string path = files.directory_path(dir);
+  if(!path.empty() && path[path.length()-1] != '/') path.push_back('/');
+  return path + name;
+}
+
+void index_file(watch_index &index, file_id id) {
+  index.by_size[files.size(id)].push_back(id);
+  index.dir_files[files.directory(id)].push_back(id);
+  index.live_files++;
+}
+
+void unindex_file(watch_index &index, file_id id, std::set<off_t> &affected) {
+  std::vector<file_id> &same_size = index.by_size[files.size(id)];
+  same_size.erase(std::find(same_size.begin(), same_size.end(), id));
+  if(same_size.empty()) index.by_size.erase(files.size(id));
+  std::vector<file_id> &in_dir = index.dir_files[files.directory(id)];
+  in_dir.erase(std::find(in_dir.begin(), in_dir.end(), id));
+  index.live_files--;
+  affected.insert(files.size(id));
+}
+
+/* Index the directories added to the store from first on, and tie
+ * them to the watches the walk put on them. */
+void index_directories(watch_index &index, dir_id first) {
+  index.dir_files.resize(files.directories());
+  index.dir_children.resize(files.directories());
+  index.dir_live.resize(files.directories(), true);
+  index.live_dirs += files.directories() - first;
+  for(dir_id dir=first; dir<files.directories(); dir++) {
+    std::string path = files.directory_path(dir);
+    if(!watcher.add(path, dir)) errormsg("could not watch %s: %s\n", path.c_str(), strerror(errno));
+  }
+}
+
+/* Stop watching dir and everything below it. */
+void drop_directory(watch_index &index, dir_id dir, std::set<off_t> &affected) {
+  if(!index.dir_live[dir]) return;
+  index.dir_live[dir] = false;
+  index.live_dirs--;
+  watcher.remove(dir);
+  std::vector<file_id> in_dir = index.dir_files[dir];
+  for(auto it=in_dir.begin(); it!=in_dir.end(); ++it) {
+    unindex_file(index, *it, affected);
+  }
+  for(auto it=index.dir_children[dir].begin(); it!=index.dir_children[dir].end(); ++it) {
+    drop_directory(index, *it, affected);
+  }
+}
+
+/* The live subdirectory name of dir, or NO_PARENT. */
+dir_id find_subdirectory(const watch_index &index, dir_id dir, const std::string &name) {
+  std::string path = entry_path(dir, name);
+  for(auto it=index.dir_children[dir].begin(); it!=index.dir_children[dir].end(); ++it) {
+    if(index.dir_live[*it] && files.directory_path(*it)==path) return *it;
+  }
+  return NO_PARENT;
+}
+
+/* Record the current version of dir/name, as the walker would have. */
+void update_file(watch_index &index, dir_id dir, const std::string &name, std::set<off_t> &affected, std::set<file_id> &fresh) {
+  const std::vector<file_id> &in_dir = index.dir_files[dir];
+  auto old = std::find_if(in_dir.begin(), in_dir.end(), [&name](file_id id) { return name==files.leaf(id); });
+  if(old!=in_dir.end()) unindex_file(index, *old, affected);
+
+  std::string path = entry_path(dir, name);
+  struct stat info;
+  if(lstat(path.c_str(), &info)!=0) return;
+  if(S_ISLNK(info.st_mode) && (!ISFLAG(flags, F_FOLLOWLINKS) || stat(path.c_str(), &info)!=0)) return;
+  if(!S_ISREG(info.st_mode)) return;
+  if(ISFLAG(flags, F_EXCLUDEEMPTY) && info.st_size == 0) return;
+  if(info.st_size <= min_size || !glob_include(path)) return;
+
+  file_id id = files.add_file(dir, name.c_str(), info.st_size, info.st_dev, info.st_ino, time_ns(info.st_mtim), time_ns(info.st_ctim));
+  index_file(index, id);
+  affected.insert(info.st_size);
+  fresh.insert(id);
+}
+
+/* Watch and walk a directory that appeared below dir. */
+void add_directory(watch_index &index, thread_pool &pool, dir_id dir, const std::string &name, std::set<off_t> &affected, std::set<file_id> &fresh) {
+  if(!ISFLAG(flags, F_RECURSE) || find_subdirectory(index, dir, name)!=NO_PARENT) return;
+  dir_id first_dir = files.directories();
+  file_id first_file = files.count();
+  {
+    dir_walker walker(pool, glob_include, is_readonly, watch_directory);
+    walker.walk(entry_path(dir, name), files.directory_read_only(dir) || is_readonly(name), files);
+  }
+  index_directories(index, first_dir);
+  /* the walk adds the new directory as a root of its own */
+  index.dir_children[dir].push_back(first_dir);
+  for(dir_id child=first_dir+1; child<files.directories(); child++) {
+    index.dir_children[files.parent_directory(child)].push_back(child);
+  }
+  for(file_id id=first_file; id<files.count(); id++) {
+    index_file(index, id);
+    affected.insert(files.size(id));
+    fresh.insert(id);
+  }
+}
+
+/*
+ * After the kernel has dropped events nothing indexed can be trusted:
+ * walk the roots again under new records, carry the checksums of files
+ * found unchanged over, and count everything else as new or gone.
+ */
+void rewalk(watch_index &index, thread_pool &pool, std::set<off_t> &affected, std::set<file_id> &fresh) {
+  std::unordered_map<std::string, file_id> old;
+  for(dir_id dir=0; dir<index.dir_live.size(); dir++) {
+    if(!index.dir_live[dir]) continue;
+    for(auto it=index.dir_files[dir].begin(); it!=index.dir_files[dir].end(); ++it) {
+      old[files.path(*it)] = *it;
+    }
+  }
+  std::set<off_t> dropped;
+  for(dir_id dir=0; dir<index.dir_live.size(); dir++) {
+    drop_directory(index, dir, dropped);
+  }
+
+  dir_id first_dir = files.directories();
+  file_id first_file = files.count();
+  {
+    dir_walker walker(pool, glob_include, is_readonly, watch_directory);
+    for(auto it=index.roots.begin(); it!=index.roots.end(); ++it) {
+      walker.walk(*it, is_readonly(*it), files);
+    }
+  }
+  index_directories(index, first_dir);
+  for(dir_id child=first_dir; child<files.directories(); child++) {
+    if(files.parent_directory(child)!=NO_PARENT) index.dir_children[files.parent_directory(child)].push_back(child);
+  }
+  for(file_id id=first_file; id<files.count(); id++) {
+    index_file(index, id);
+    auto found = old.find(files.path(id));
+    if(found!=old.end()) {
+      file_id was = found->second;
+      old.erase(found);
+      if(files.size(was)==files.size(id) && files.device(was)==files.device(id) && files.inode(was)==files.inode(id) &&
+         files.mtime(was)==files.mtime(id) && files.ctime(was)==files.ctime(id)) {
+        files.copy_checksums(was, id);
+        continue;
+      }
+      affected.insert(files.size(was));
+    }
+    affected.insert(files.size(id));
+    fresh.insert(id);
+  }
+  /* whatever was not found again has gone */
+  for(auto it=old.begin(); it!=old.end(); ++it) {
+    affected.insert(files.size(it->second));
+  }
+}
+
+/*
+ * Rewrite the store without the records left behind by changed files
+ * and dropped directories, once they outnumber the live ones, so that
+ * watching a busy tree does not grow the store without bound. Ids held
+ * anywhere but in the index are invalid afterwards.
+ */
+void compact_store(watch_index &index) {
+  size_t dead_files = files.count() - index.live_files;
+  size_t dead_dirs = files.directories() - index.live_dirs;
+  if(std::max(dead_files, dead_dirs) < WATCH_COMPACT_MIN) return;
+  if(dead_files <= index.live_files && dead_dirs <= index.live_dirs) return;
+
+  std::vector<bool> keep_files(files.count(), false);
+  for(auto dir=index.dir_files.begin(); dir!=index.dir_files.end(); ++dir) {
+    for(auto it=dir->begin(); it!=dir->end(); ++it) {
+      keep_files[*it] = true;
+    }
+  }
+  std::vector<file_id> file_ids;
+  std::vector<dir_id> dir_ids;
+  files.compact(keep_files, index.dir_live, file_ids, dir_ids);
+  watcher.renumber(dir_ids);
+
+  watch_index compacted;
+  compacted.roots.swap(index.roots);
+  compacted.dir_files.resize(files.directories());
+  compacted.dir_children.resize(files.directories());
+  compacted.dir_live.assign(files.directories(), true);
+  compacted.live_files = index.live_files;
+  compacted.live_dirs = index.live_dirs;
+  for(dir_id dir=0; dir<dir_ids.size(); dir++) {
+    if(dir_ids[dir]==NO_PARENT) continue;
+    for(auto it=index.dir_files[dir].begin(); it!=index.dir_files[dir].end(); ++it) {
+      compacted.dir_files[dir_ids[dir]].push_back(file_ids[*it]);
+    }
+    for(auto it=index.dir_children[dir].begin(); it!=index.dir_children[dir].end(); ++it) {
+      if(dir_ids[*it]!=NO_PARENT) compacted.dir_children[dir_ids[dir]].push_back(dir_ids[*it]);
+    }
+  }
+  for(auto size=index.by_size.begin(); size!=index.by_size.end(); ++size) {
+    std::vector<file_id> &ids = compacted.by_size[size->first];
+    for(auto it=size->second.begin(); it!=size->second.end(); ++it) {
+      ids.push_back(file_ids[*it]);
+    }
+  }
+  index = std::move(compacted);
+}
+
+/* Match the buckets of the affected sizes again, reporting the sets
+ * that gained a new or changed file. */
+void rematch(thread_pool &pool, const watch_index &index, const std::set<off_t> &affected, const std::set<file_id> &fresh) {
+  std::atomic<size_t> progress(0);
+  for(auto size_it=affected.begin(); size_it!=affected.end(); ++size_it) {
+    auto found = index.by_size.find(*size_it);
+    if(found==index.by_size.end() || found->second.size()<2) continue;
+    std::vector<file_id> order(found->second);
+    std::sort(order.begin(), order.end(), std::greater<file_id>());
+
+    size_bucket bucket;
+    bucket.size = *size_it;
+    bucket.paths = order.data();
+    bucket.count = order.size();
+    collapse_hardlinks(bucket);
+    if(bucket.candidates()<=1 && !ISFLAG(flags, F_CONSIDERHARDLINKS)) continue;
+    cache_state known;
+    if(cache.is_open() && bucket.size>0) lookup_cached(bucket, known);
+
+    std::vector<match_set> matched;
+    match_bucket(pool, bucket, known, matched, progress);
+    for(auto set=matched.begin(); set!=matched.end(); ++set) {
+      if(std::none_of(set->begin(), set->end(), [&fresh](file_id id) { return fresh.count(id)>0; })) continue;
+      if(output==OUTPUT_NDJSON) {
+        print_ndjson(*set);
+      } else {
+        print_set(*set);
+        fflush(stdout);
+      }
+    }
+  }
+  if(cache.is_open()) cache.flush();
+}
+
+/*
+ * Keep watching the scanned tree after the first report. Events are
+ * gathered until WATCH_SETTLE_MS pass without one (or at most
+ * WATCH_MAX_DELAY_MS), then only the size buckets they touched are
+ * matched again, reusing every checksum already known. Sets are
+ * reported once they include a new or changed file. Runs until
+ * interrupted.
+ */
+void watch_matches() {
+  watch_index index;
+  index_directories(index, 0);
+  for(dir_id dir=0; dir<files.directories(); dir++) {
+    if(files.parent_directory(dir)!=NO_PARENT) {
+      index.dir_children[files.parent_directory(dir)].push_back(dir);
+    } else {
+      index.roots.push_back(files.directory_path(dir));
+    }
+  }
+  for(file_id id=0; id<files.count(); id++) {
+    index_file(index, id);
+  }
+  SETFLAG(flags, F_HIDEPROGRESS);
+  thread_pool pool(num_threads);
+
+  while(true) {
+    std::vector<watch_event> events;
+    if(!watcher.wait(-1, events)) break;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t seen=0; events.size()>seen; ) {
+      seen = events.size();
+      if(std::chrono::steady_clock::now() - start > std::chrono::milliseconds(WATCH_MAX_DELAY_MS)) break;
+      if(!watcher.wait(WATCH_SETTLE_MS, events)) break;
+    }
+
+    std::set<off_t> affected;
+    std::set<file_id> fresh;
+    if(std::any_of(events.begin(), events.end(), [](const watch_event &event) { return event.change==WATCH_OVERFLOW; })) {
+      errormsg("too many changes at once, scanning again\n");
+      rewalk(index, pool, affected, fresh);
+      rematch(pool, index, affected, fresh);
+      compact_store(index);
+      continue;
+    }
+    /* a file written several times is looked at once, as it is now */
+    std::set<std::pair<dir_id, std::string>> written;
+    for(auto it=events.begin(); it!=events.end(); ++it) {
+      if(!index.dir_live[it->dir]) continue;
+      switch(it->change) {
+        case WATCH_FILE_WRITTEN:
+        case WATCH_FILE_REMOVED:
+          written.insert(std::make_pair(it->dir, it->name));
+          break;
+        case WATCH_DIR_ADDED:
+          add_directory(index, pool, it->dir, it->name, affected, fresh);
+          break;
+        case WATCH_DIR_REMOVED:
+          if(it->name.empty()) {
+            drop_directory(index, it->dir, affected);
+          } else {
+            dir_id child = find_subdirectory(index, it->dir, it->name);
+            if(child!=NO_PARENT) drop_directory(index, child, affected);
+          }
+          break;
+        default:
+          break;
       }
     }
+    for(auto it=written.begin(); it!=written.end(); ++it) {
+      if(index.dir_live[it->first]) update_file(index, it->first, it->second, affected, fresh);
+    }
+    rematch(pool, index, affected, fresh);
+    compact_store(index);
+  }
+  errormsg("could not watch for changes: %s\n", strerror(errno));
+  exit(1);
+}
+
+/*
+ * Read every scanned file through each backend in turn, from a cold
+ * cache as far as posix_fadvise() allows, and report the throughput.
+ */
+void benchmark_backends() {
+  off_t total = 0;
+  for(file_id id=0; id<files.count(); id++) {
+    total += files.size(id);
+  }
+
+  printf("%zu files, %.1f megabytes, %u thread%s\n", files.count(), total / (1024.0 * 1024.0), num_threads, num_threads!=1 ? "s" : "");
+  printf("%-8s %10s %10s %10s\n", "backend", "seconds", "MB/s", "files/s");
+  thread_pool pool(num_threads);
+  for(int b=0; b<READ_BACKENDS; b++) {
+    io_backend = (read_backend)b;
+    for(file_id id=0; id<files.count(); id++) {
+      file_reader::evict(files.path(id));
+    }
+
+    std::atomic<size_t> failures(0);
+    auto start = std::chrono::steady_clock::now();
+    {
+      task_group tasks(pool);
+      for(file_id id=0; id<files.count(); id++) {
+        tasks.run([id, &failures]() {
+          uint32_t crc;
+          if(!checksum(id, files.size(id), STAGE_FULL, crc)) failures++;
+        });
+      }
+      tasks.wait();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("%-8s %10.2f %10.1f %10.0f", file_reader::backend_name(io_backend), elapsed.count(),
+           total / (1024.0 * 1024.0) / elapsed.count(), files.count() / elapsed.count());
+    if(failures>0) printf("  (%zu unreadable)", failures.load());
+    printf("\n");
+  }
+}
+
+void dump_filelist() {
+  for(file_id id=0; id<files.count(); id++) {
+    fprintf( stderr, "\n%u\t'%s'\t%zu", id, files.path(id).c_str(), files.size(id) );
   }
   fprintf( stderr, "\n" );
 }
@@ -577,12 +1879,31 @@ void help_text()
   printf(" -i glob\tonly include files matching 'glob'; multiple\n");
   printf("   \tinstances, files must match at least one 'glob'\n");
   printf(" -s\tfollow symlinks\n");
+  printf(" -H\treport hard links to the same file as duplicates;\n");
+  printf("   \tby default only one path of each file is listed\n");
   printf(" -n\texclude zero-length files from consideration\n");
   printf(" -f\tomit the first file in each set of matches\n");
   printf(" -1\tlist each set of matches on a single line\n");
   printf(" -S\tshow size of duplicate files\n");
   printf(" -m\tsummarize dupe information\n");
   printf(" -M min\tOnly process files of size at least 'min' bytes\n");
+  printf(" -p\tcompare candidates side by side in a single pass,\n");
+  printf("   \treading every byte at most once\n");
+  printf(" -b name\tread files with backend 'name': pread (default),\n");
+  printf("   \tmmap, or direct to bypass the page cache\n");
+  printf(" -B\tbenchmark every read backend on the scanned files\n");
+  printf(" -P\tread candidates in on-disk order, one device at\n");
+  printf("   \ta time each; helps on spinning disks\n");
+  printf(" -D path=N\tkeep at most N reads in flight on the device\n");
+  printf("   \tholding 'path', 0 for no limit; by default %d on\n", ROTATIONAL_DEPTH);
+  printf("   \tspinning disks and unlimited on others\n");
+  printf(" -u depth\tchecksum small files through io_uring, keeping\n");
+  printf("   \t'depth' requests in flight (e.g. 256)\n");
+  printf(" -c file\tkeep checksums in the sqlite database 'file' and\n");
+  printf("   \treuse them for files whose size, mtime and ctime are\n");
+  printf("   \tunchanged\n");
+  printf(" -j N\tscan and hash using N threads; 0 uses one thread\n");
+  printf("   \tper CPU (default 1)\n");
   printf(" -q\thide progress indicator\n");
   printf(" -d\tprompt user for files to preserve and delete all\n"); 
   printf("   \tothers; important: under particular circumstances,\n");
@@ -590,6 +1911,47 @@ void help_text()
   printf("   \twith -s or --symlinks, or when specifying a\n");
   printf("   \tparticular directory more than once; refer to the\n");
   printf("   \tfdupes documentation for additional information\n");
+  printf(" --dedupe\tinstead of deleting duplicates, make them share\n");
+  printf("   \tstorage: FIDEDUPERANGE where the filesystem supports\n");
+  printf("   \treflinks (btrfs, XFS), hard links elsewhere\n");
+  printf(" --hash=name\tdecide matches by a strong digest instead of CRC32\n");
+  printf("   \tand byte comparison: sha256 or blake2b (default crc32)\n");
+  printf(" --verify\twith --hash, still byte compare files whose\n");
+  printf("   \tdigests agree, cached or not\n");
+  printf(" --sample[=N]\tbefore reading whole files, compare N blocks sampled\n");
+  printf("   \tat the middle, tail, head and then seeded random\n");
+  printf("   \toffsets of each (default 3)\n");
+  printf(" --sample-seed=S\tseed for the random sample offsets\n");
+  printf(" --output=fmt\treport sets as 'text' (default) or 'ndjson': one\n");
+  printf("   \tJSON object per set, with sizes, device and inode\n");
+  printf("   \tnumbers, hashes and read only flags, written as soon\n");
+  printf("   \tas the set is confirmed\n");
+  printf(" --spill=dir\tkeep memory bounded on huge trees: write scanned\n");
+  printf("   \tfiles to sorted run files in 'dir' and load back only\n");
+  printf("   \tthose whose size is shared with another file\n");
+  printf(" --stats[=json]\tafter the run, report files scanned per second,\n");
+  printf("   \tstat calls, and per stage files and bytes read,\n");
+  printf("   \ttime spent and candidates ruled out; to stderr,\n");
+  printf("   \tas a table or as one JSON object\n");
+  printf(" --watch\tafter the first report, keep watching the\n");
+  printf("   \tdirectories and report sets as new or changed\n");
+  printf("   \tfiles join them, until interrupted; Linux only\n");
+  printf(" --savings-first\tcheck sizes in order of the space their\n");
+  printf("   \tduplicates could free (size times copies less one)\n");
+  printf("   \tand list sets as they are confirmed\n");
+  printf(" --time-budget=T\tcheck savings first, starting no more checks\n");
+  printf("   \tafter T seconds of running, or Tm or Th\n");
+  printf(" --read-budget=N\tcheck savings first, starting no more checks\n");
+  printf("   \tonce N bytes (or NK, NM, NG, NT) have been read\n");
+  printf(" --reflinks=how\tfiles of equal size whose data lies in the very\n");
+  printf("   \tsame extents (reflinked copies) are read only once;\n");
+  printf("   \t'report' lists them marked (reflinked), 'exclude'\n");
+  printf("   \tleaves them out, 'read' (default) reads them all;\n");
+  printf("   \t'report' cannot be used with -d or --dedupe\n");
+  printf(" --trees\treport directories whose files and subdirectories\n");
+  printf("   \tare all identical, names included, as one set at\n");
+  printf("   \tthe highest level they match; then the file sets\n");
+  printf("   \tnot wholly inside those\n");
   printf(" -N\ttogether with --delete, preserve the first file in\n");
   printf("   \teach set of duplicates and delete the rest without\n");
   printf("   \twithout prompting the user\n");
@@ -597,11 +1959,49 @@ void help_text()
   printf(" -h\tdisplay this help message\n\n");
 }
 
+/* Long options without a short equivalent. */
+enum {
+  OPT_DEDUPE = 256,
+  OPT_HASH,
+  OPT_VERIFY,
+  OPT_SAMPLE,
+  OPT_SAMPLE_SEED,
+  OPT_OUTPUT,
+  OPT_SPILL,
+  OPT_STATS,
+  OPT_WATCH,
+  OPT_SAVINGS_FIRST,
+  OPT_TIME_BUDGET,
+  OPT_READ_BUDGET,
+  OPT_REFLINKS,
+  OPT_TREES
+};
+
+static const struct option long_options[] = {
+  { "dedupe", no_argument, NULL, OPT_DEDUPE },
+  { "hash", required_argument, NULL, OPT_HASH },
+  { "verify", no_argument, NULL, OPT_VERIFY },
+  { "sample", optional_argument, NULL, OPT_SAMPLE },
+  { "sample-seed", required_argument, NULL, OPT_SAMPLE_SEED },
+  { "output", required_argument, NULL, OPT_OUTPUT },
+  { "spill", required_argument, NULL, OPT_SPILL },
+  { "stats", optional_argument, NULL, OPT_STATS },
+  { "watch", no_argument, NULL, OPT_WATCH },
+  { "savings-first", no_argument, NULL, OPT_SAVINGS_FIRST },
+  { "time-budget", required_argument, NULL, OPT_TIME_BUDGET },
+  { "read-budget", required_argument, NULL, OPT_READ_BUDGET },
+  { "reflinks", required_argument, NULL, OPT_REFLINKS },
+  { "trees", no_argument, NULL, OPT_TREES },
+  { NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char *argv[]) {
   program_name = argv[0];
 
+  unsigned int sample_points = 0;
+  uint64_t sample_seed = 0;
   int opt;
-  while ((opt = getopt(argc, argv, "rq1SsndvhNM:R:i:")) != EOF) {
+  while ((opt = getopt_long(argc, argv, "rq1SsHndvhNpBPM:R:i:j:c:b:u:D:", long_options, NULL)) != EOF) {
     switch (opt) {
       case 'r':
         SETFLAG(flags, F_RECURSE);
@@ -618,6 +2018,9 @@ int main(int argc, char *argv[]) {
       case 's':
         SETFLAG(flags, F_FOLLOWLINKS);
         break;
+      case 'H':
+        SETFLAG(flags, F_CONSIDERHARDLINKS);
+        break;
       case 'n':
         SETFLAG(flags, F_EXCLUDEEMPTY);
         break;
@@ -633,18 +2036,124 @@ int main(int argc, char *argv[]) {
       case 'N':
         SETFLAG(flags, F_NOPROMPT);
         break;
+      case OPT_DEDUPE:
+        SETFLAG(flags, F_DEDUPE);
+        break;
+      case OPT_HASH:
+        if (!digest_context::parse_kind(optarg, strong_hash)) {
+          errormsg("unknown hash '%s'\n", optarg);
+          exit(1);
+        }
+        break;
+      case OPT_VERIFY:
+        SETFLAG(flags, F_VERIFY);
+        break;
+      case OPT_SAMPLE:
+        sample_points = optarg ? atoi(optarg) : 3;
+        break;
+      case OPT_SAMPLE_SEED:
+        sample_seed = strtoull(optarg, NULL, 0);
+        break;
+      case OPT_OUTPUT:
+        if (strcmp(optarg, "text")==0) {
+          output = OUTPUT_TEXT;
+        } else if (strcmp(optarg, "ndjson")==0) {
+          output = OUTPUT_NDJSON;
+        } else {
+          errormsg("unknown output format '%s'\n", optarg);
+          exit(1);
+        }
+        break;
+      case OPT_SPILL:
+        spill_dir = optarg;
+        break;
+      case OPT_STATS:
+        if (optarg && strcmp(optarg, "json")==0) {
+          stats_json = true;
+        } else if (optarg && strcmp(optarg, "text")!=0) {
+          errormsg("unknown statistics format '%s'\n", optarg);
+          exit(1);
+        }
+        stats.enable();
+        break;
+      case OPT_WATCH:
+        watch = true;
+        break;
+      case OPT_SAVINGS_FIRST:
+        savings_first = true;
+        break;
+      case OPT_TIME_BUDGET: {
+        perf_stats::clock::duration budget;
+        if (!parse_duration(optarg, budget)) {
+          errormsg("bad time budget '%s'\n", optarg);
+          exit(1);
+        }
+        /* counted from the start of the run */
+        deadline = perf_stats::clock::now() + budget;
+        savings_first = true;
+        break;
+      }
+      case OPT_TREES:
+        trees = true;
+        break;
+      case OPT_REFLINKS:
+        if (strcmp(optarg, "report")==0) {
+          reflinks = REFLINKS_REPORT;
+        } else if (strcmp(optarg, "exclude")==0) {
+          reflinks = REFLINKS_EXCLUDE;
+        } else if (strcmp(optarg, "read")==0) {
+          reflinks = REFLINKS_READ;
+        } else {
+          errormsg("unknown reflink handling '%s'\n", optarg);
+          exit(1);
+        }
+        break;
+      case OPT_READ_BUDGET:
+        if (!parse_bytes(optarg, read_budget) || read_budget==0) {
+          errormsg("bad read budget '%s'\n", optarg);
+          exit(1);
+        }
+        savings_first = true;
+        break;
       case 'M':
 	min_size = atol(optarg);
 	break;
+      case 'j':
+        num_threads = atoi(optarg)>0 ? atoi(optarg) : thread_pool::default_threads();
+        break;
+      case 'p':
+        SETFLAG(flags, F_REFINE);
+        break;
+      case 'b':
+        if (!file_reader::parse_backend(optarg, io_backend)) {
+          errormsg("unknown read backend '%s'\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'B':
+        SETFLAG(flags, F_BENCHMARK);
+        break;
+      case 'P':
+        SETFLAG(flags, F_PHYSORDER);
+        break;
+      case 'D':
+        if (!parse_device_depth(optarg)) {
+          errormsg("bad device depth '%s', expected path=N\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'u':
+        uring_depth = atoi(optarg)>0 ? atoi(optarg) : 0;
+        break;
+      case 'c':
+        if (!cache.open(optarg)) exit(1);
+        break;
       case 'R':
-        read_only.insert(optarg);
+        read_only_list.push_back(optarg);
+        read_only_names.add_literal(optarg);
         break;
       case 'i':
-#ifdef HAVE_FNMATCH_H
-        globs.insert(optarg);
-#else
-        printf("WARNING: Not compiled with glob support. Ignoring inclusion on '%s'.\n", optarg);
-#endif
+        globs.add(optarg);
         break;
 
       default:
@@ -657,32 +2166,83 @@ int main(int argc, char *argv[]) {
     errormsg("no directories specified\n");
     exit(1);
   }
+  sampler.configure(sample_points, sample_seed);
+  globs.compile();
+  read_only_names.compile();
+  if (ISFLAG(flags, F_DEDUPE) && ISFLAG(flags, F_DELETEFILES)) {
+    errormsg("--dedupe and -d cannot be used together\n");
+    exit(1);
+  }
+  if (output==OUTPUT_NDJSON && (ISFLAG(flags, F_DEDUPE) || ISFLAG(flags, F_DELETEFILES))) {
+    errormsg("--output=ndjson only reports; it cannot be used with -d or --dedupe\n");
+    exit(1);
+  }
+  if (trees && (ISFLAG(flags, F_DEDUPE) || ISFLAG(flags, F_DELETEFILES) || watch || !spill_dir.empty())) {
+    errormsg("--trees only reports; it cannot be used with -d, --dedupe, --watch or --spill\n");
+    exit(1);
+  }
+  /* sharing extents is not proof enough to act on a file unread */
+  if (reflinks==REFLINKS_REPORT && (ISFLAG(flags, F_DEDUPE) || ISFLAG(flags, F_DELETEFILES))) {
+    errormsg("--reflinks=report cannot be used with -d or --dedupe\n");
+    exit(1);
+  }
+  if (watch && (ISFLAG(flags, F_DEDUPE) || ISFLAG(flags, F_DELETEFILES) || !spill_dir.empty())) {
+    errormsg("--watch only reports; it cannot be used with -d, --dedupe or --spill\n");
+    exit(1);
+  }
 
-  if(min_size != 0) {
-    printf( "minimum file size to consider: %zu\n", min_size );
+  if (watch && !watcher.open()) {
+    errormsg("could not watch for changes: %s\n", strerror(errno));
+    exit(1);
   }
-  for (int x = optind; x < argc; x++) {
-    scandir( argv[x], is_readonly(argv[x]) );
+
+  /* keep stdout to one JSON object per line */
+  if(min_size != 0 && output==OUTPUT_TEXT) {
+    printf( "minimum file size to consider: %zu\n", min_size );
   }
-  if(read_only.size()>0) {
+  scandirs(argv + optind, argc - optind);
+  if(strong_hash!=DIGEST_NONE) files.enable_digests(strong_hash);
+  if(read_only_list.size()>0 && output==OUTPUT_TEXT) {
     printf("Read only paths: ");
-    for (auto it=read_only.begin(); it!=read_only.end(); ++it) {
+    for (auto it=read_only_list.begin(); it!=read_only_list.end(); ++it) {
       printf("'%s' ", it->c_str() );
     }
     printf("\n");
     printf("Total read only files: %zu.\n", read_only_file_count);
   }
 
+  if (ISFLAG(flags, F_BENCHMARK)) {
+    benchmark_backends();
+    return 0;
+  }
+
   //dump_filelist();
   build_matches();
-  if (ISFLAG(flags, F_DELETEFILES)) {
-    if (ISFLAG(flags, F_NOPROMPT)) {
-      deletefiles(false);
+  /* watching goes on using and filling the cache */
+  if (!watch) cache.close();
+  {
+    phase_timer timer(PHASE_ACTION);
+    if (ISFLAG(flags, F_DEDUPE)) {
+      dedupefiles();
+    } else if (ISFLAG(flags, F_DELETEFILES)) {
+      if (ISFLAG(flags, F_NOPROMPT)) {
+        deletefiles(false);
+      } else {
+        deletefiles(true);
+      }
+    } else if (trees) {
+      print_trees();
     } else {
-      deletefiles(true);
+      printmatches();
     }
-  } else {
-    printmatches();
+  }
+  if (stats.enabled()) {
+    fflush(stdout);
+    stats.report(stderr, stats_json, files.scanned());
+  }
+  if (watch) {
+    fflush(stdout);
+    watch_matches();
   }
 
   return 0;
@@ -0,0 +1,61 @@
+#ifndef FDUPES_H
+#define FDUPES_H
+
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+#include <time.h>
+
+#define MAX_PARTIAL_SIZE (off_t)1024
+
+#define ISFLAG(a,b) ((a & b) == b)
+#define SETFLAG(a,b) (a |= b)
+
+#define F_RECURSE           0x0001
+#define F_HIDEPROGRESS      0x0002
+#define F_DSAMELINE         0x0004
+#define F_FOLLOWLINKS       0x0008
+#define F_DELETEFILES       0x0010
+#define F_EXCLUDEEMPTY      0x0020
+#define F_CONSIDERHARDLINKS 0x0040
+#define F_SHOWSIZE          0x0080
+#define F_NOPROMPT          0x0100
+#define F_REFINE            0x0200
+#define F_BENCHMARK         0x0400
+#define F_PHYSORDER         0x0800
+#define F_DEDUPE            0x1000
+#define F_VERIFY            0x2000
+
+class crc32 {
+  public:
+    bool valid;
+    uint32_t crc;
+
+    crc32()
+      : valid(false), crc(0)
+    {}
+    bool operator!=(const crc32 &other) const {
+      return (valid!=other.valid || crc!=other.crc);
+    }
+    bool operator==(const crc32 &other) const {
+      return (valid==other.valid && crc==other.crc);
+    }
+    crc32 &operator=(uint32_t t_crc) {
+      crc = t_crc;
+      valid = true;
+      return *this;
+    }
+};
+
+extern unsigned long flags;
+extern off_t min_size;
+
+void errormsg(const char *message, ...);
+
+/* A stat time in nanoseconds, e.g. time_ns(info.st_mtim). */
+inline int64_t time_ns(const struct timespec &time) {
+  return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+#endif//FDUPES_H
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Benchmark fdupes on generated corpora. Directory scanning, matching
+# (build_matches) and the CRC kernels are timed separately, so that a
+# change can be checked against reproducible numbers.
+#
+# usage: fdupes_bench.sh CORPUS_GEN FDUPES CRC_BENCH DIR [RUNS]
+#
+# Corpora are generated under DIR once and kept for later runs; they are
+# regenerated when their parameters change. Timings are the median of
+# RUNS runs (default 5) on a warm page cache; the first run warms it.
+
+set -e
+
+if [ $# -lt 4 ]; then
+  echo "usage: $0 CORPUS_GEN FDUPES CRC_BENCH DIR [RUNS]" >&2
+  exit 1
+fi
+corpus_gen=$1
+fdupes=$2
+crc_bench=$3
+dir=$4
+runs=${5:-5}
+
+# name and corpus_gen options of every corpus
+profiles="
+small   -n 50000 -s 0:4096 -c 0.2 -H 0.1 -d 4 -w 4 -S 1
+mixed   -n 5000 -s 1:4194304 -c 0.2 -H 0.1 -d 3 -w 4 -S 2
+headers -n 1000 -s 65536:1048576 -c 0.05 -H 0.5 -d 2 -w 4 -S 3
+"
+
+# value of a numeric JSON field in the --stats=json report
+field() {
+  sed -n "s/.*\"$1\":\([0-9.e+-]*\).*/\1/p"
+}
+
+median() {
+  sort -g | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+mkdir -p "$dir"
+echo "$profiles" | while read name options; do
+  [ -n "$name" ] || continue
+  corpus=$dir/$name
+  if [ "$(cat "$corpus.options" 2>/dev/null)" != "$options" ]; then
+    rm -rf "$corpus" "$corpus.options"
+    mkdir -p "$corpus"
+    printf "%-8s " "$name"
+    "$corpus_gen" $options "$corpus"
+    echo "$options" > "$corpus.options"
+  fi
+done
+
+printf "\n%-8s %10s %12s %10s %10s %10s\n" "corpus" "files" "files/s" "scan s" "group s" "match s"
+echo "$profiles" | while read name options; do
+  [ -n "$name" ] || continue
+  "$fdupes" -r -q "$dir/$name" > /dev/null
+  reports=$dir/$name.stats
+  : > "$reports"
+  i=0
+  while [ $i -lt "$runs" ]; do
+    "$fdupes" -r -q --stats=json "$dir/$name" 2>> "$reports" > /dev/null
+    i=$((i + 1))
+  done
+  printf "%-8s %10s %12.0f %10.3f %10.3f %10.3f\n" "$name" \
+    "$(field files_scanned < "$reports" | head -1)" \
+    "$(field files_per_second < "$reports" | median)" \
+    "$(field scan < "$reports" | median)" \
+    "$(field group < "$reports" | median)" \
+    "$(field match < "$reports" | median)"
+done
+
+echo
+"$crc_bench"
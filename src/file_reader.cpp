@@ -0,0 +1,228 @@
+#include "file_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Satisfies O_DIRECT on every common block device. */
+#define READ_ALIGN (size_t)4096
+
+static inline off_t align_down(off_t value) {
+  return value & ~(off_t)(READ_ALIGN-1);
+}
+
+static inline off_t align_up(off_t value) {
+  return align_down(value + READ_ALIGN - 1);
+}
+
+/*
+ * pread() into a private aligned buffer. With direct set the window read
+ * is widened to block boundaries, as O_DIRECT requires; evict asks the
+ * kernel to drop what was read, for filesystems refusing O_DIRECT.
+ */
+class pread_reader : public file_reader {
+  public:
+    pread_reader(int fd, off_t size, bool direct, bool evict)
+      : file_reader(fd, size), m_buffer(NULL), m_capacity(0), m_direct(direct), m_evict(evict)
+    {
+      if(!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    ~pread_reader() {
+      free(m_buffer);
+    }
+
+    ssize_t next(const unsigned char *&data, size_t length) {
+      if(m_offset>=m_size) return 0;
+      length = std::min(std::min(length, READ_BLOCK), (size_t)(m_size-m_offset));
+      if(next_hole(data, length)) return length;
+
+      off_t start = m_direct ? align_down(m_offset) : m_offset;
+      off_t end = m_direct ? align_up(m_offset+length) : m_offset+length;
+      if(!reserve(end-start)) return -1;
+
+      size_t wanted = m_offset+length-start;
+      size_t done = 0;
+      while(done<wanted) {
+        ssize_t r = pread(m_fd, m_buffer+done, end-start-done, start+done);
+        if(r<0 && errno==EINTR) continue;
+        if(r<=0) return -1;
+        done += r;
+      }
+      if(m_evict) posix_fadvise(m_fd, start, done, POSIX_FADV_DONTNEED);
+
+      data = m_buffer + (m_offset-start);
+      m_offset += length;
+      return length;
+    }
+  protected:
+    bool reserve(size_t capacity) {
+      if(capacity<=m_capacity) return true;
+      void *buffer = NULL;
+      if(posix_memalign(&buffer, READ_ALIGN, capacity)!=0) return false;
+      free(m_buffer);
+      m_buffer = (unsigned char *)buffer;
+      m_capacity = capacity;
+      return true;
+    }
+
+    unsigned char *m_buffer;
+    size_t m_capacity;
+    bool m_direct;
+    bool m_evict;
+};
+
+class mmap_reader : public file_reader {
+  public:
+    mmap_reader(int fd, off_t size)
+      : file_reader(fd, size), m_map(NULL)
+    {}
+    ~mmap_reader() {
+      if(m_map!=NULL) munmap(m_map, m_size);
+    }
+
+    bool map() {
+      if(m_size==0) return true;
+      void *map = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+      if(map==MAP_FAILED) return false;
+      madvise(map, m_size, MADV_SEQUENTIAL);
+      m_map = (unsigned char *)map;
+      return true;
+    }
+
+    ssize_t next(const unsigned char *&data, size_t length) {
+      if(m_offset>=m_size) return 0;
+      length = std::min(std::min(length, READ_BLOCK), (size_t)(m_size-m_offset));
+      /* spares faulting in the hole's pages */
+      if(next_hole(data, length)) return length;
+      data = m_map + m_offset;
+      m_offset += length;
+      return length;
+    }
+  protected:
+    unsigned char *m_map;
+};
+
+file_reader::file_reader(int fd, off_t size)
+  : m_fd(fd), m_size(size), m_offset(0), m_sparse(false), m_in_hole(false)
+    , m_data_start(0), m_data_end(0), m_hole_start(0), m_hole_end(0)
+{}
+
+bool file_reader::next_hole(const unsigned char *&data, size_t length) {
+  static const unsigned char zeros[READ_BLOCK] = { 0 };
+  m_in_hole = false;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  if(!m_sparse) return false;
+  if(m_offset>=m_data_start && m_offset<m_data_end) return false;
+  if(m_offset<m_hole_start || m_offset>=m_hole_end) {
+    off_t found = lseek(m_fd, m_offset, SEEK_DATA);
+    if(found<0 && errno==ENXIO) found = m_size;
+    if(found<0) {
+      /* no extent information here: read everything */
+      m_sparse = false;
+      return false;
+    }
+    if(found==m_offset) {
+      found = lseek(m_fd, m_offset, SEEK_HOLE);
+      if(found<0) {
+        m_sparse = false;
+        return false;
+      }
+      m_data_start = m_offset;
+      m_data_end = found;
+      return false;
+    }
+    m_hole_start = m_offset;
+    m_hole_end = found;
+  }
+  if(m_offset+(off_t)length > m_hole_end) return false;
+
+  data = zeros;
+  m_offset += length;
+  m_in_hole = true;
+  return true;
+#else
+  (void)data;
+  (void)length;
+  return false;
+#endif
+}
+
+file_reader::~file_reader() {
+  close(m_fd);
+}
+
+file_reader *file_reader::open(const std::string &path, off_t size, read_backend backend) {
+  int fd = -1;
+  bool evict = false;
+  if(backend==READ_DIRECT) {
+    fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+    if(fd<0 && errno==EINVAL) {
+      fd = ::open(path.c_str(), O_RDONLY);
+      evict = true;
+    }
+  } else {
+    fd = ::open(path.c_str(), O_RDONLY);
+  }
+  if(fd<0) return NULL;
+
+  /* a file that shrank since the scan would fault under mmap */
+  struct stat info;
+  if(fstat(fd, &info)!=0 || info.st_size<size) {
+    ::close(fd);
+    errno = ESTALE;
+    return NULL;
+  }
+
+  file_reader *reader;
+  switch(backend) {
+    case READ_MMAP: {
+      mmap_reader *mapped = new mmap_reader(fd, size);
+      if(!mapped->map()) {
+        int error = errno;
+        delete mapped;
+        errno = error;
+        return NULL;
+      }
+      reader = mapped;
+      break;
+    }
+    case READ_DIRECT:
+      reader = new pread_reader(fd, size, !evict, evict);
+      break;
+    default:
+      reader = new pread_reader(fd, size, false, false);
+  }
+  /* only files short of blocks can have holes worth looking up */
+  reader->m_sparse = (off_t)info.st_blocks * 512 < info.st_size;
+  return reader;
+}
+
+void file_reader::evict(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd<0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  ::close(fd);
+}
+
+const char *file_reader::backend_name(read_backend backend) {
+  switch(backend) {
+    case READ_PREAD: return "pread";
+    case READ_MMAP: return "mmap";
+    case READ_DIRECT: return "direct";
+    default: return "unknown";
+  }
+}
+
+bool file_reader::parse_backend(const std::string &name, read_backend &backend) {
+  for(int i=0; i<READ_BACKENDS; i++) {
+    if(name==backend_name((read_backend)i)) {
+      backend = (read_backend)i;
+      return true;
+    }
+  }
+  return false;
+}
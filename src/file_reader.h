@@ -0,0 +1,70 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <cstdlib>
+#include <string>
+
+#include <sys/types.h>
+
+#define READ_BLOCK (size_t)(1024*1024)
+
+enum read_backend {
+  READ_PREAD,    /* large aligned pread() with sequential read-ahead */
+  READ_MMAP,     /* mmap() the file, madvise() sequential */
+  READ_DIRECT,   /* O_DIRECT, bypassing (and not evicting) the page cache */
+  READ_BACKENDS
+};
+
+/*
+ * Streams a file front to back through one of the read backends. next()
+ * hands out a pointer to the following chunk, which stays valid until
+ * the next call. Chunks are capped at READ_BLOCK and cut short only at
+ * the end of the file, so two readers over equal-sized files given the
+ * same requests stay in step.
+ *
+ * In files with fewer blocks allocated than their size needs, holes
+ * are found with SEEK_DATA and SEEK_HOLE. A chunk lying wholly in a
+ * hole is not read: it points at shared zeros and in_hole() is set, so
+ * callers may skip looking at it. Chunks only partly in a hole are read
+ * as usual, the kernel filling in the zeros, which keeps chunks the
+ * same whatever the layout.
+ */
+class file_reader {
+  public:
+    virtual ~file_reader();
+
+    /* NULL (with errno set) if the file cannot be opened. */
+    static file_reader *open(const std::string &path, off_t size, read_backend backend);
+
+    /* Bytes available at data, 0 at end of file, -1 on error. */
+    virtual ssize_t next(const unsigned char *&data, size_t length)=0;
+    /* Whether the last chunk handed out was all hole. */
+    bool in_hole() const {
+      return m_in_hole;
+    }
+
+    /* Drop the file's cached pages, e.g. before timing a backend. */
+    static void evict(const std::string &path);
+
+    static const char *backend_name(read_backend backend);
+    static bool parse_backend(const std::string &name, read_backend &backend);
+  protected:
+    file_reader(int fd, off_t size);
+    file_reader(const file_reader &)=delete;
+    file_reader &operator=(const file_reader &)=delete;
+
+    /* Whether the chunk of length bytes at m_offset is all hole; if so,
+     * hands it out as zeros. */
+    bool next_hole(const unsigned char *&data, size_t length);
+
+    int m_fd;
+    off_t m_size;
+    off_t m_offset;
+    bool m_sparse;
+    bool m_in_hole;
+    /* the last extents looked up */
+    off_t m_data_start, m_data_end;
+    off_t m_hole_start, m_hole_end;
+};
+
+#endif//FILE_READER_H
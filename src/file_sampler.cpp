@@ -0,0 +1,54 @@
+#include "file_sampler.h"
+
+#include <algorithm>
+#include <random>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "crc_32.h"
+
+file_sampler::file_sampler()
+  : m_points(0), m_seed(0)
+{}
+
+void file_sampler::configure(unsigned int points, uint64_t seed) {
+  m_points = points;
+  m_seed = seed;
+}
+
+bool file_sampler::applies(off_t size) const {
+  return m_points>0 && size >= 4 * (off_t)m_points * SAMPLE_BLOCK;
+}
+
+void file_sampler::offsets(off_t size, std::vector<off_t> &offsets) const {
+  off_t last = size - SAMPLE_BLOCK;
+  off_t fixed[] = { (size / 2) / SAMPLE_BLOCK * SAMPLE_BLOCK, last, 0 };
+  offsets.clear();
+  for(unsigned int i=0; i<m_points && i<3; i++) {
+    offsets.push_back(fixed[i]);
+  }
+  std::mt19937_64 generator(m_seed ^ (uint64_t)size);
+  std::uniform_int_distribution<off_t> block(0, last / SAMPLE_BLOCK);
+  for(unsigned int i=3; i<m_points; i++) {
+    offsets.push_back(block(generator) * SAMPLE_BLOCK);
+  }
+  std::sort(offsets.begin(), offsets.end());
+}
+
+bool file_sampler::checksum(const std::string &path, off_t size, uint32_t &crc) const {
+  std::vector<off_t> points;
+  offsets(size, points);
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd<0) return false;
+  unsigned char buffer[SAMPLE_BLOCK];
+  crc = 0;
+  bool ok = true;
+  for(auto it=points.begin(); it!=points.end() && ok; ++it) {
+    ok = pread(fd, buffer, SAMPLE_BLOCK, *it)==(ssize_t)SAMPLE_BLOCK;
+    if(ok) crc = crc32(crc, buffer, SAMPLE_BLOCK);
+  }
+  close(fd);
+  return ok;
+}
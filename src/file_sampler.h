@@ -0,0 +1,41 @@
+#ifndef FILE_SAMPLER_H
+#define FILE_SAMPLER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+/* Bytes read at every sample point. */
+#define SAMPLE_BLOCK (off_t)4096
+
+/*
+ * Fingerprints a file from a few blocks spread across it: the middle,
+ * the tail and the head, then further points at offsets drawn from a
+ * seeded generator. Offsets depend only on the file size and the seed,
+ * so equal-sized files are always sampled at the same places and their
+ * fingerprints can be compared.
+ */
+class file_sampler {
+  public:
+    file_sampler();
+
+    /* points==0 turns sampling off. */
+    void configure(unsigned int points, uint64_t seed);
+    unsigned int points() const {
+      return m_points;
+    }
+
+    /* Only files at least four times the sampled bytes are sampled. */
+    bool applies(off_t size) const;
+    /* Sample offsets for files of this size, ascending. */
+    void offsets(off_t size, std::vector<off_t> &offsets) const;
+    /* CRC of the sampled blocks in offset order; false if unreadable. */
+    bool checksum(const std::string &path, off_t size, uint32_t &crc) const;
+  protected:
+    unsigned int m_points;
+    uint64_t m_seed;
+};
+
+#endif//FILE_SAMPLER_H
@@ -0,0 +1,226 @@
+#include "file_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+file_store::file_store()
+  : m_size(), m_device(), m_inode(), m_mtime(), m_ctime(), m_crcpartial(), m_crcfull(), m_crcsample(), m_valid(), m_dir(), m_leaf()
+    , m_digest_kind(DIGEST_NONE), m_digest()
+    , m_dir_parent(), m_dir_name(), m_dir_read_only()
+    , m_scanned(0), m_scanned_read_only(0), m_spill()
+    , m_blocks(), m_block_used(0), m_block_size(0)
+{}
+
+uint64_t file_store::add_name(const char *name) {
+  size_t length = strlen(name) + 1;
+  if(m_blocks.empty() || m_block_used + length > m_block_size) {
+    /* only a root's path could outgrow a block */
+    m_block_size = std::max(NAME_BLOCK, length);
+    m_blocks.push_back(std::unique_ptr<char[]>(new char[m_block_size]));
+    m_block_used = 0;
+  }
+  uint64_t offset = ((uint64_t)(m_blocks.size()-1) << 32) | m_block_used;
+  memcpy(m_blocks.back().get() + m_block_used, name, length);
+  m_block_used += length;
+  return offset;
+}
+
+dir_id file_store::add_directory(dir_id parent, const char *name, bool read_only) {
+  m_dir_parent.push_back(parent);
+  m_dir_name.push_back(add_name(name));
+  m_dir_read_only.push_back(read_only);
+  return m_dir_parent.size()-1;
+}
+
+file_id file_store::add_file(dir_id dir, const char *name, off_t size, dev_t device, ino_t inode, int64_t mtime, int64_t ctime) {
+  m_scanned++;
+  if(m_dir_read_only[dir]) m_scanned_read_only++;
+  if(m_spill) {
+    m_spill->add(dir, name, size, device, inode, mtime, ctime);
+    return NO_FILE;
+  }
+  return store_file(dir, name, size, device, inode, mtime, ctime);
+}
+
+file_id file_store::store_file(dir_id dir, const char *name, off_t size, dev_t device, ino_t inode, int64_t mtime, int64_t ctime) {
+  m_size.push_back(size);
+  m_device.push_back(device);
+  m_inode.push_back(inode);
+  m_mtime.push_back(mtime);
+  m_ctime.push_back(ctime);
+  m_crcpartial.push_back(0);
+  m_crcfull.push_back(0);
+  m_crcsample.push_back(0);
+  m_valid.push_back(0);
+  m_dir.push_back(dir);
+  m_leaf.push_back(add_name(name));
+  /* files added after enable_digests(), while watching */
+  if(m_digest_kind!=DIGEST_NONE) m_digest.push_back(digest_t());
+  return m_size.size()-1;
+}
+
+void file_store::spill(const std::string &directory) {
+  m_spill.reset(new spill_runs(directory));
+}
+
+bool file_store::merge_spilled() {
+  if(!m_spill) return true;
+  std::unique_ptr<spill_runs> runs(std::move(m_spill));
+  return runs->merge([this](const spilled_file &file, const char *name) {
+    store_file(file.dir, name, file.size, file.device, file.inode, file.mtime, file.ctime);
+  });
+}
+
+void file_store::shrink() {
+  m_size.shrink_to_fit();
+  m_device.shrink_to_fit();
+  m_inode.shrink_to_fit();
+  m_mtime.shrink_to_fit();
+  m_ctime.shrink_to_fit();
+  m_crcpartial.shrink_to_fit();
+  m_crcfull.shrink_to_fit();
+  m_crcsample.shrink_to_fit();
+  m_valid.shrink_to_fit();
+  m_dir.shrink_to_fit();
+  m_leaf.shrink_to_fit();
+  m_dir_parent.shrink_to_fit();
+  m_dir_name.shrink_to_fit();
+  m_dir_read_only.shrink_to_fit();
+}
+
+void file_store::enable_digests(digest_kind kind) {
+  m_digest_kind = kind;
+  m_digest.resize(m_size.size());
+}
+
+/* Move row i of column to ids[i], for the rows kept. */
+template<typename T>
+static void keep_rows(std::vector<T> &column, const std::vector<uint32_t> &ids, uint32_t dropped, size_t kept) {
+  for(size_t i=0; i<ids.size(); i++) {
+    if(ids[i]!=dropped) column[ids[i]] = column[i];
+  }
+  column.resize(kept);
+  column.shrink_to_fit();
+}
+
+void file_store::compact(const std::vector<bool> &keep_files, const std::vector<bool> &keep_dirs,
+                         std::vector<file_id> &file_ids, std::vector<dir_id> &dir_ids) {
+  dir_ids.assign(m_dir_parent.size(), NO_PARENT);
+  size_t dirs = 0;
+  for(dir_id dir=0; dir<m_dir_parent.size(); dir++) {
+    if(keep_dirs[dir]) dir_ids[dir] = dirs++;
+  }
+  file_ids.assign(m_size.size(), NO_FILE);
+  size_t kept = 0;
+  for(file_id id=0; id<m_size.size(); id++) {
+    if(keep_files[id]) file_ids[id] = kept++;
+  }
+
+  /* names move to fresh blocks, read from the old ones as they go */
+  std::vector<std::unique_ptr<char[]>> blocks;
+  blocks.swap(m_blocks);
+  m_block_used = m_block_size = 0;
+  auto old_name = [&blocks](uint64_t offset) {
+    return blocks[offset >> 32].get() + (uint32_t)offset;
+  };
+  for(dir_id dir=0; dir<dir_ids.size(); dir++) {
+    if(dir_ids[dir]==NO_PARENT) continue;
+    if(m_dir_parent[dir]!=NO_PARENT) m_dir_parent[dir] = dir_ids[m_dir_parent[dir]];
+    m_dir_name[dir] = add_name(old_name(m_dir_name[dir]));
+  }
+  for(file_id id=0; id<file_ids.size(); id++) {
+    if(file_ids[id]==NO_FILE) continue;
+    m_dir[id] = dir_ids[m_dir[id]];
+    m_leaf[id] = add_name(old_name(m_leaf[id]));
+  }
+
+  keep_rows(m_dir_parent, dir_ids, NO_PARENT, dirs);
+  keep_rows(m_dir_name, dir_ids, NO_PARENT, dirs);
+  keep_rows(m_dir_read_only, dir_ids, NO_PARENT, dirs);
+  keep_rows(m_size, file_ids, NO_FILE, kept);
+  keep_rows(m_device, file_ids, NO_FILE, kept);
+  keep_rows(m_inode, file_ids, NO_FILE, kept);
+  keep_rows(m_mtime, file_ids, NO_FILE, kept);
+  keep_rows(m_ctime, file_ids, NO_FILE, kept);
+  keep_rows(m_crcpartial, file_ids, NO_FILE, kept);
+  keep_rows(m_crcfull, file_ids, NO_FILE, kept);
+  keep_rows(m_crcsample, file_ids, NO_FILE, kept);
+  keep_rows(m_valid, file_ids, NO_FILE, kept);
+  keep_rows(m_dir, file_ids, NO_FILE, kept);
+  keep_rows(m_leaf, file_ids, NO_FILE, kept);
+  if(m_digest_kind!=DIGEST_NONE) keep_rows(m_digest, file_ids, NO_FILE, kept);
+}
+
+void file_store::append_path(dir_id dir, std::string &path) const {
+  if(m_dir_parent[dir]!=NO_PARENT) {
+    append_path(m_dir_parent[dir], path);
+    if(!path.empty() && path[path.length()-1] != '/') path.push_back('/');
+  }
+  path += name(m_dir_name[dir]);
+}
+
+std::string file_store::directory_path(dir_id dir) const {
+  std::string path;
+  append_path(dir, path);
+  return path;
+}
+
+std::string file_store::path(file_id id) const {
+  std::string path;
+  append_path(m_dir[id], path);
+  if(!path.empty() && path[path.length()-1] != '/') path.push_back('/');
+  path += name(m_leaf[id]);
+  return path;
+}
+
+class crc32 file_store::crcpartial(file_id id) const {
+  class crc32 crc;
+  if(m_valid[id] & PARTIAL_VALID) crc = m_crcpartial[id];
+  return crc;
+}
+
+class crc32 file_store::crcfull(file_id id) const {
+  class crc32 crc;
+  if(m_valid[id] & FULL_VALID) crc = m_crcfull[id];
+  return crc;
+}
+
+class crc32 file_store::crcsample(file_id id) const {
+  class crc32 crc;
+  if(m_valid[id] & SAMPLE_VALID) crc = m_crcsample[id];
+  return crc;
+}
+
+void file_store::set_crcpartial(file_id id, uint32_t crc) {
+  m_crcpartial[id] = crc;
+  m_valid[id] |= PARTIAL_VALID;
+}
+
+void file_store::set_crcfull(file_id id, uint32_t crc) {
+  m_crcfull[id] = crc;
+  m_valid[id] |= FULL_VALID;
+}
+
+void file_store::set_crcsample(file_id id, uint32_t crc) {
+  m_crcsample[id] = crc;
+  m_valid[id] |= SAMPLE_VALID;
+}
+
+void file_store::copy_checksums(file_id from, file_id to) {
+  m_crcpartial[to] = m_crcpartial[from];
+  m_crcfull[to] = m_crcfull[from];
+  m_crcsample[to] = m_crcsample[from];
+  m_valid[to] = m_valid[from];
+  if(m_digest_kind!=DIGEST_NONE) m_digest[to] = m_digest[from];
+}
+
+bool file_store::digest(file_id id, digest_t &digest) const {
+  if(!(m_valid[id] & DIGEST_VALID)) return false;
+  digest = m_digest[id];
+  return true;
+}
+
+void file_store::set_digest(file_id id, const digest_t &digest) {
+  m_digest[id] = digest;
+  m_valid[id] |= DIGEST_VALID;
+}
@@ -0,0 +1,178 @@
+#ifndef FILE_STORE_H
+#define FILE_STORE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "digest.h"
+#include "fdupes.h"
+#include "spill_runs.h"
+
+typedef uint32_t file_id;
+typedef uint32_t dir_id;
+
+#define NO_PARENT (dir_id)-1
+/* Returned by add_file() while records are being spilled. */
+#define NO_FILE (file_id)-1
+
+/* Size of the blocks leaf names are packed into. */
+#define NAME_BLOCK (size_t)(1024*1024)
+
+/*
+ * Every scanned file, stored by column: one flat vector per attribute,
+ * indexed by file_id in scan order. Paths are not kept whole. A file
+ * records its directory and the offset of its leaf name in a block
+ * arena, and a directory likewise its parent and its own name, so a
+ * file costs a few dozen bytes plus its leaf name however deep it is.
+ *
+ * Strong digests take DIGEST_SIZE bytes per file, so their column is
+ * only allocated by enable_digests().
+ *
+ * After spill(), files go to sorted runs on disk instead, and only
+ * those that share their size with another file are loaded back by
+ * merge_spilled(), largest first. Directories are always kept.
+ *
+ * Records are added from one thread. Afterwards the checksums of
+ * distinct files may be set from different threads.
+ */
+class file_store {
+  public:
+    file_store();
+    file_store(const file_store &)=delete;
+    file_store &operator=(const file_store &)=delete;
+
+    /* A root is named by its path and has parent NO_PARENT. */
+    dir_id add_directory(dir_id parent, const char *name, bool read_only);
+    /* mtime and ctime are in nanoseconds, as time_ns() gives them */
+    file_id add_file(dir_id dir, const char *name, off_t size, dev_t device, ino_t inode, int64_t mtime, int64_t ctime);
+    /* Spill files added from now on to run files in directory. */
+    void spill(const std::string &directory);
+    /* False if the runs could not be written or read back. */
+    bool merge_spilled();
+    /* Give back the slack left by growing the columns. */
+    void shrink();
+    /* Make room for a digest of every file added so far. */
+    void enable_digests(digest_kind kind);
+    /* Drop the files and directories not marked to keep, and their
+     * names, keeping the order of the rest. A kept directory's parent
+     * must be kept. file_ids and dir_ids map old ids to new, NO_FILE
+     * and NO_PARENT for those dropped. */
+    void compact(const std::vector<bool> &keep_files, const std::vector<bool> &keep_dirs,
+                 std::vector<file_id> &file_ids, std::vector<dir_id> &dir_ids);
+
+    size_t count() const {
+      return m_size.size();
+    }
+    /* Every file added, including any not loaded back from a spill. */
+    size_t scanned() const {
+      return m_scanned;
+    }
+    size_t scanned_read_only() const {
+      return m_scanned_read_only;
+    }
+
+    std::string path(file_id id) const;
+    dir_id directory(file_id id) const {
+      return m_dir[id];
+    }
+    const char *leaf(file_id id) const {
+      return name(m_leaf[id]);
+    }
+    off_t size(file_id id) const {
+      return m_size[id];
+    }
+    dev_t device(file_id id) const {
+      return m_device[id];
+    }
+    ino_t inode(file_id id) const {
+      return m_inode[id];
+    }
+    int64_t mtime(file_id id) const {
+      return m_mtime[id];
+    }
+    int64_t ctime(file_id id) const {
+      return m_ctime[id];
+    }
+    bool read_only(file_id id) const {
+      return m_dir_read_only[m_dir[id]];
+    }
+
+    size_t directories() const {
+      return m_dir_parent.size();
+    }
+    dir_id parent_directory(dir_id dir) const {
+      return m_dir_parent[dir];
+    }
+    std::string directory_path(dir_id dir) const;
+    bool directory_read_only(dir_id dir) const {
+      return m_dir_read_only[dir];
+    }
+
+    class crc32 crcpartial(file_id id) const;
+    class crc32 crcfull(file_id id) const;
+    class crc32 crcsample(file_id id) const;
+    void set_crcpartial(file_id id, uint32_t crc);
+    void set_crcfull(file_id id, uint32_t crc);
+    void set_crcsample(file_id id, uint32_t crc);
+
+    /* Give to the checksums of from, a record of the same version of
+     * the same file. */
+    void copy_checksums(file_id from, file_id to);
+
+    digest_kind digest_type() const {
+      return m_digest_kind;
+    }
+    /* False unless a digest was recorded. */
+    bool digest(file_id id, digest_t &digest) const;
+    void set_digest(file_id id, const digest_t &digest);
+
+    /* Whether the file was found to share all its extents with another. */
+    bool shared_extents(file_id id) const {
+      return m_valid[id] & SHARED_EXTENTS;
+    }
+    void set_shared_extents(file_id id) {
+      m_valid[id] |= SHARED_EXTENTS;
+    }
+  protected:
+    enum { PARTIAL_VALID = 0x1, FULL_VALID = 0x2, DIGEST_VALID = 0x4, SAMPLE_VALID = 0x8, SHARED_EXTENTS = 0x10 };
+
+    uint64_t add_name(const char *name);
+    file_id store_file(dir_id dir, const char *name, off_t size, dev_t device, ino_t inode, int64_t mtime, int64_t ctime);
+    const char *name(uint64_t offset) const {
+      return m_blocks[offset >> 32].get() + (uint32_t)offset;
+    }
+    void append_path(dir_id dir, std::string &path) const;
+
+    std::vector<off_t> m_size;
+    std::vector<dev_t> m_device;
+    std::vector<ino_t> m_inode;
+    std::vector<int64_t> m_mtime;
+    std::vector<int64_t> m_ctime;
+    std::vector<uint32_t> m_crcpartial;
+    std::vector<uint32_t> m_crcfull;
+    std::vector<uint32_t> m_crcsample;
+    std::vector<uint8_t> m_valid;
+    std::vector<dir_id> m_dir;
+    std::vector<uint64_t> m_leaf;
+    digest_kind m_digest_kind;
+    std::vector<digest_t> m_digest;
+
+    std::vector<dir_id> m_dir_parent;
+    std::vector<uint64_t> m_dir_name;
+    std::vector<bool> m_dir_read_only;
+
+    size_t m_scanned;
+    size_t m_scanned_read_only;
+    std::unique_ptr<spill_runs> m_spill;
+
+    /* names are NUL terminated; offsets are block << 32 | position */
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    size_t m_block_used;
+    size_t m_block_size;
+};
+
+#endif//FILE_STORE_H
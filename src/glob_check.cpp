@@ -0,0 +1,118 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fnmatch.h>
+
+#include "glob_set.h"
+
+/*
+ * Checks glob_set against fnmatch(3) with no flags in the C locale, both
+ * before and after compile(): every short pattern over the bytes that
+ * matter to brackets against every short text, then random patterns
+ * built from bracket pieces, one at a time and a few to a set.
+ */
+
+#define SHORT_PATTERN 4
+#define SHORT_TEXT 3
+#define RANDOM_PATTERNS 50000
+#define RANDOM_TEXTS 40
+
+static const char pattern_bytes[] = "[]!^-*?\\:.=a";
+static const char text_bytes[] = "[]!-.a/A";
+
+static const char *pieces[] = {
+  "[", "]", "!", "^", "-", "*", "?", "\\", ":", ".", "=", "a", "b", "z", "/",
+  "[:", ":]", "[=", "=]", "[.", ".]", "[:alpha:]", "[:digit:]", "[:punct:]",
+  "[:bogus:]", "[:z:]", "[=a=]", "[.a.]", "[.-.]", "[.ab.]", "a-z", "]-a", "\\]"
+};
+
+static void all_strings(const char *bytes, size_t length, std::string prefix, std::vector<std::string> &out) {
+  out.push_back(prefix);
+  if(prefix.length()==length) return;
+  for(const char *byte=bytes; *byte; byte++) {
+    all_strings(bytes, length, prefix + *byte, out);
+  }
+}
+
+static bool fnmatches(const std::vector<std::string> &patterns, const std::string &text) {
+  for(auto it=patterns.begin(); it!=patterns.end(); ++it) {
+    if(fnmatch(it->c_str(), text.c_str(), 0)==0) return true;
+  }
+  return false;
+}
+
+/* Compare one set on every text, uncompiled then compiled; false on a mismatch. */
+static bool check(const std::vector<std::string> &patterns, const std::vector<std::string> &texts) {
+  glob_set set;
+  for(auto it=patterns.begin(); it!=patterns.end(); ++it) {
+    set.add(*it);
+  }
+  for(int compiled=0; compiled<2; compiled++) {
+    if(compiled) set.compile();
+    for(auto text=texts.begin(); text!=texts.end(); ++text) {
+      bool expect = fnmatches(patterns, *text);
+      if(set.match(*text)==expect) continue;
+      fprintf(stderr, "%s:", compiled ? "compiled" : "simulated");
+      for(auto it=patterns.begin(); it!=patterns.end(); ++it) {
+        fprintf(stderr, " \"%s\"", it->c_str());
+      }
+      fprintf(stderr, " on \"%s\": got %d, expected %d\n", text->c_str(), !expect, expect);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int, char *[]) {
+  /* '^' negates only while this is unset */
+  unsetenv("POSIXLY_CORRECT");
+  int failures = 0;
+
+  const char *cases[][2] = {
+    { "[[.]", "[" }, { "[*-", "[/--" }, { "[ab", "[ab" }, { "[ab", "a" }, { "[[a", "[a" },
+    { "[!]]", "a" }, { "[]-a]", "_" }, { "[[:alpha:]]", "x" }, { "[[:alpha:]", "[:alpha:" },
+    { "[[.a.]-]", "a" }, { "[a[=b]", "a" }, { "[a-\\]]", "a" }, { "\\", "\\" }
+  };
+  for(size_t i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+    if(!check({ cases[i][0] }, { cases[i][1] })) failures++;
+  }
+
+  std::vector<std::string> patterns, texts;
+  all_strings(pattern_bytes, SHORT_PATTERN, "", patterns);
+  all_strings(text_bytes, SHORT_TEXT, "", texts);
+  for(auto it=patterns.begin(); it!=patterns.end() && failures<10; ++it) {
+    if(!check({ *it }, texts)) failures++;
+  }
+
+  std::mt19937 random(42);
+  const size_t piece_count = sizeof(pieces)/sizeof(pieces[0]);
+  for(int i=0; i<RANDOM_PATTERNS && failures<10; i++) {
+    std::vector<std::string> set(1 + (i%8==0 ? random()%3 : 0));
+    for(auto it=set.begin(); it!=set.end(); ++it) {
+      for(size_t length=random()%8; length>0; length--) {
+        *it += pieces[random()%piece_count];
+      }
+    }
+    /* texts from the pattern's own bytes, and a few others */
+    std::string from = set[0] + "aZ0 /\xe9";
+    texts.clear();
+    for(int t=0; t<RANDOM_TEXTS; t++) {
+      std::string text;
+      for(size_t length=random()%6; length>0; length--) {
+        text += from[random()%from.length()];
+      }
+      texts.push_back(text);
+    }
+    if(!check(set, texts)) failures++;
+  }
+
+  printf("glob_set %s\n", failures ? "WRONG" : "ok");
+  return failures == 0 ? 0 : 1;
+}
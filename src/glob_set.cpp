@@ -0,0 +1,411 @@
+#include "glob_set.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <iterator>
+#include <map>
+
+typedef int (*class_test)(int);
+
+/* The test for the C locale class name; NULL if unknown. */
+static class_test find_class(const std::string &name) {
+  static const struct {
+    const char *name;
+    class_test test;
+  } classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+    { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+    { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+  };
+  for(size_t i=0; i<sizeof(classes)/sizeof(classes[0]); i++) {
+    if(name==classes[i].name) return classes[i].test;
+  }
+  return NULL;
+}
+
+/* fnmatch gives up on a class name this long */
+#ifdef CHARCLASS_NAME_MAX
+# define GLOB_CLASS_MAX CHARCLASS_NAME_MAX
+#else
+# define GLOB_CLASS_MAX 256
+#endif
+
+/* pattern[pos], or the terminating NUL fnmatch would see past the end */
+static unsigned char at(const std::string &pattern, size_t pos) {
+  return pos<pattern.length() ? pattern[pos] : '\0';
+}
+
+/*
+ * Read the "[.x.]" whose '[' is just before pattern[pos], moving pos past
+ * it; false if it is not closed or, as in C, names more than one byte.
+ */
+static bool collating_symbol(const std::string &pattern, size_t &pos, unsigned char &symbol) {
+  size_t i = pos;
+  for(size_t length=0; ; length++) {
+    unsigned char c = at(pattern, ++i);
+    if(c=='.' && at(pattern, i+1)==']') {
+      if(length!=1) return false;
+      symbol = pattern[pos+1];
+      pos = i+2;
+      return true;
+    }
+    if(c=='\0') return false;
+  }
+}
+
+enum bracket_scan {
+  BRACKET_HIT,      /* byte is in the set */
+  BRACKET_CLOSED,   /* byte is not, pos is past the ']' */
+  BRACKET_FAILED,   /* the pattern can't match */
+  BRACKET_UNCLOSED  /* no ']', the '[' is an ordinary byte */
+};
+
+/*
+ * Look for byte in the bracket expression from pattern[pos], past any
+ * negation, the way glibc's fnmatch does in the C locale, down to how it
+ * reads malformed brackets. On a hit pos is just past what matched.
+ */
+static bracket_scan scan_bracket(const std::string &pattern, size_t &pos, unsigned char byte) {
+  unsigned char c = at(pattern, pos++);
+  for(;;) {
+    bool plain = true, escaped = false;
+    if(c=='\\') {
+      if(at(pattern, pos)=='\0') return BRACKET_FAILED;
+      c = pattern[pos++];
+      escaped = true;
+    } else if(c=='[' && at(pattern, pos)==':') {
+      /* a name only of 'a' to 'y' is a class, else the '[' is a member */
+      std::string name;
+      for(size_t i=pos; ; ) {
+        if(name.length()==GLOB_CLASS_MAX) return BRACKET_FAILED;
+        unsigned char next = at(pattern, ++i);
+        if(next==':' && at(pattern, i+1)==']') {
+          pos = i+2;
+          plain = false;
+          break;
+        }
+        if(next<'a' || next>='z') break;
+        name += next;
+      }
+      if(!plain) {
+        class_test test = find_class(name);
+        if(test==NULL) return BRACKET_FAILED;
+        if(test(byte)) return BRACKET_HIT;
+        c = at(pattern, pos++);
+      }
+    } else if(c=='[' && at(pattern, pos)=='=') {
+      unsigned char equal = at(pattern, pos+1);
+      if(equal!='\0' && at(pattern, pos+2)=='=' && at(pattern, pos+3)==']') {
+        pos += 4;
+        if(equal==byte) return BRACKET_HIT;
+        c = at(pattern, pos++);
+        plain = false;
+      }
+    } else if(c=='\0') {
+      return BRACKET_UNCLOSED;
+    }
+    if(plain) {
+      /* the first byte of a range only matches through the range */
+      unsigned char low = c;
+      bool range;
+      if(c=='[' && !escaped && at(pattern, pos)=='.') {
+        if(!collating_symbol(pattern, pos, low)) return BRACKET_FAILED;
+        range = at(pattern, pos)=='-' && at(pattern, pos+1)!='\0';
+      } else {
+        range = at(pattern, pos)=='-' && at(pattern, pos+1)!='\0' && at(pattern, pos+1)!=']';
+      }
+      if(!range && low==byte) return BRACKET_HIT;
+      c = at(pattern, pos++);
+      if(c=='-' && at(pattern, pos)!=']') {
+        unsigned char high = at(pattern, pos++);
+        if(high=='[' && at(pattern, pos)=='.') {
+          if(!collating_symbol(pattern, pos, high)) return BRACKET_FAILED;
+        } else {
+          if(high=='\\') high = at(pattern, pos++);
+          if(high=='\0') return BRACKET_FAILED;
+        }
+        if(low<=byte && byte<=high) return BRACKET_HIT;
+        c = at(pattern, pos++);
+      }
+    }
+    if(c==']') return BRACKET_CLOSED;
+  }
+}
+
+/*
+ * Skip the rest of a bracket expression after a hit, as fnmatch does,
+ * moving pos past the ']'.
+ */
+static bracket_scan skip_bracket(const std::string &pattern, size_t &pos) {
+  unsigned char c;
+  do {
+    c = at(pattern, pos++);
+    if(c=='\0') return BRACKET_UNCLOSED;
+    if(c=='\\') {
+      if(at(pattern, pos)=='\0') return BRACKET_FAILED;
+      pos++;
+    } else if(c=='[' && at(pattern, pos)==':') {
+      for(size_t i=pos, length=1; ; length++) {
+        c = at(pattern, ++i);
+        if(length==GLOB_CLASS_MAX) return BRACKET_FAILED;
+        if(c==':' && at(pattern, i+1)==']') {
+          pos = i+2;
+          break;
+        }
+        /* not a class after all: go on from the ':' */
+        if(c<'a' || c>='z') {
+          c = ':';
+          break;
+        }
+      }
+    } else if(c=='[' && at(pattern, pos)=='=') {
+      if(at(pattern, pos+1)=='\0') return BRACKET_FAILED;
+      if(at(pattern, pos+2)!='=' || at(pattern, pos+3)!=']') return BRACKET_FAILED;
+      pos += 4;
+    } else if(c=='[' && at(pattern, pos)=='.') {
+      for(pos++; at(pattern, pos)!='.' || at(pattern, pos+1)!=']'; pos++) {
+        if(at(pattern, pos)=='\0') return BRACKET_FAILED;
+      }
+      pos += 2;
+    }
+  } while(c!=']');
+  return BRACKET_CLOSED;
+}
+
+/*
+ * Parse the bracket expression whose '[' is just before pattern[pos] into
+ * the bytes it matches, keyed by where the rest of the pattern resumes
+ * after each: past the ']', or at pos itself when fnmatch reads the '['
+ * as an ordinary byte. Nothing is added if it can't match at all.
+ */
+static void parse_bracket(const std::string &pattern, size_t pos, std::map<size_t, std::bitset<256>> &resume) {
+  bool negate = at(pattern, pos)=='!' || at(pattern, pos)=='^';
+  for(int byte=0; byte<256; byte++) {
+    size_t i = pos + negate;
+    switch(scan_bracket(pattern, i, byte)) {
+      case BRACKET_HIT:
+        switch(skip_bracket(pattern, i)) {
+          case BRACKET_CLOSED:
+            if(!negate) resume[i].set(byte);
+            break;
+          case BRACKET_UNCLOSED:
+            if(byte=='[') resume[pos].set(byte);
+            break;
+          default:
+            break;
+        }
+        break;
+      case BRACKET_CLOSED:
+        if(negate) resume[i].set(byte);
+        break;
+      case BRACKET_UNCLOSED:
+        if(byte=='[') resume[pos].set(byte);
+        break;
+      case BRACKET_FAILED:
+        break;
+    }
+  }
+}
+
+glob_set::glob_set()
+  : m_tokens(), m_end(), m_base(), m_compiled(false), m_class(), m_classes(0), m_next(), m_accept()
+{}
+
+void glob_set::add_token(std::vector<token> &tokens, const token &next) {
+  /* runs of stars match what one does */
+  if(next.star && !tokens.empty() && tokens.back().star) return;
+  tokens.push_back(next);
+}
+
+void glob_set::add_tokens(const std::vector<token> &tokens) {
+  m_base.push_back(m_tokens.size());
+  m_tokens.insert(m_tokens.end(), tokens.begin(), tokens.end());
+  m_end.resize(m_tokens.size(), false);
+  m_tokens.push_back(token());
+  m_end.push_back(true);
+  m_compiled = false;
+}
+
+void glob_set::add(const std::string &pattern) {
+  add_from(pattern, 0, std::vector<token>());
+}
+
+/*
+ * Add pattern from pos on, after tokens. A bracket whose bytes resume the
+ * pattern at different places adds one pattern for each place.
+ */
+void glob_set::add_from(const std::string &pattern, size_t pos, std::vector<token> tokens) {
+  for(size_t i=pos; i<pattern.length(); ) {
+    unsigned char c = pattern[i++];
+    token next;
+    next.star = false;
+    switch(c) {
+      case '*':
+        next.star = true;
+        break;
+      case '?':
+        next.bytes.set();
+        break;
+      case '[': {
+        std::map<size_t, std::bitset<256>> resume;
+        parse_bracket(pattern, i, resume);
+        if(resume.empty()) {
+          /* nothing after it matters */
+          i = pattern.length();
+          break;
+        }
+        auto last = std::prev(resume.end());
+        for(auto it=resume.begin(); it!=last; ++it) {
+          std::vector<token> fork(tokens);
+          next.bytes = it->second;
+          add_token(fork, next);
+          add_from(pattern, it->first, fork);
+        }
+        next.bytes = last->second;
+        i = last->first;
+        break;
+      }
+      case '\\':
+        /* a trailing backslash never matches */
+        if(i<pattern.length()) next.bytes.set((unsigned char)pattern[i++]);
+        break;
+      default:
+        next.bytes.set(c);
+    }
+    add_token(tokens, next);
+  }
+  add_tokens(tokens);
+}
+
+void glob_set::add_literal(const std::string &text) {
+  std::vector<token> tokens(text.length());
+  for(size_t i=0; i<text.length(); i++) {
+    tokens[i].star = false;
+    tokens[i].bytes.set((unsigned char)text[i]);
+  }
+  add_tokens(tokens);
+}
+
+/* Add the positions reachable without reading a byte; keeps them sorted. */
+void glob_set::closure(std::vector<uint32_t> &positions) const {
+  size_t count = positions.size();
+  for(size_t i=0; i<count; i++) {
+    if(!m_end[positions[i]] && m_tokens[positions[i]].star) positions.push_back(positions[i]+1);
+  }
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+}
+
+void glob_set::step(const std::vector<uint32_t> &from, unsigned char byte, std::vector<uint32_t> &to) const {
+  to.clear();
+  for(auto it=from.begin(); it!=from.end(); ++it) {
+    if(m_end[*it]) continue;
+    const token &current = m_tokens[*it];
+    if(current.star) {
+      to.push_back(*it);
+    } else if(current.bytes.test(byte)) {
+      to.push_back(*it+1);
+    }
+  }
+  closure(to);
+}
+
+bool glob_set::accepting(const std::vector<uint32_t> &positions) const {
+  return std::any_of(positions.begin(), positions.end(), [this](uint32_t position) { return m_end[position]; });
+}
+
+void glob_set::compile() {
+  m_compiled = false;
+  m_next.clear();
+  m_accept.clear();
+  if(empty()) return;
+
+  /* bytes that every token treats alike form one class */
+  std::map<std::vector<bool>, unsigned char> signatures;
+  for(int byte=0; byte<256; byte++) {
+    std::vector<bool> signature;
+    for(auto it=m_tokens.begin(); it!=m_tokens.end(); ++it) {
+      if(!it->star) signature.push_back(it->bytes.test(byte));
+    }
+    auto found = signatures.insert(std::make_pair(signature, (unsigned char)signatures.size()));
+    m_class[byte] = found.first->second;
+  }
+  m_classes = signatures.size();
+  unsigned char representative[256];
+  for(int byte=255; byte>=0; byte--) {
+    representative[m_class[byte]] = byte;
+  }
+
+  /* subset construction, breadth first from the start */
+  std::vector<std::vector<uint32_t>> states(2);
+  std::map<std::vector<uint32_t>, state> known;
+  known[states[0]] = 0;
+  states[1] = m_base;
+  closure(states[1]);
+  known[states[1]] = 1;
+  std::vector<uint32_t> next;
+  for(state current=0; current<states.size(); current++) {
+    m_accept.push_back(accepting(states[current]));
+    for(size_t c=0; c<m_classes; c++) {
+      step(states[current], representative[c], next);
+      auto found = known.find(next);
+      if(found==known.end()) {
+        if(states.size()>=GLOB_MAX_STATES) {
+          m_next.clear();
+          m_accept.clear();
+          return;
+        }
+        found = known.insert(std::make_pair(next, (state)states.size())).first;
+        states.push_back(next);
+      }
+      m_next.push_back(found->second);
+    }
+  }
+  m_compiled = true;
+}
+
+/* The NFA a step at a time, for sets too large for a DFA. */
+bool glob_set::simulate(const char *text, size_t length) const {
+  std::vector<uint32_t> current(m_base), next;
+  closure(current);
+  for(size_t i=0; i<length && !current.empty(); i++) {
+    step(current, text[i], next);
+    current.swap(next);
+  }
+  return accepting(current);
+}
+
+bool glob_set::match(const char *text, size_t length) const {
+  if(!m_compiled) return !empty() && simulate(text, length);
+  state current = 1;
+  for(size_t i=0; i<length && current!=0; i++) {
+    current = m_next[current * m_classes + m_class[(unsigned char)text[i]]];
+  }
+  return m_accept[current];
+}
+
+bool glob_set::match_component(const std::string &path) const {
+  if(empty()) return false;
+  if(!m_compiled) {
+    for(size_t begin=0, end; begin<path.length(); begin=end+1) {
+      end = path.find_first_of("/\\", begin);
+      if(end==std::string::npos) end = path.length();
+      if(end>begin && simulate(path.data()+begin, end-begin)) return true;
+    }
+    return false;
+  }
+  state current = 1;
+  size_t length = 0;
+  for(size_t i=0; i<=path.length(); i++) {
+    if(i==path.length() || path[i]=='/' || path[i]=='\\') {
+      if(length>0 && m_accept[current]) return true;
+      current = 1;
+      length = 0;
+    } else {
+      current = m_next[current * m_classes + m_class[(unsigned char)path[i]]];
+      length++;
+    }
+  }
+  return false;
+}
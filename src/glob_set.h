@@ -0,0 +1,73 @@
+#ifndef GLOB_SET_H
+#define GLOB_SET_H
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Past this many DFA states a set is matched by simulating the NFA. */
+#define GLOB_MAX_STATES 4096
+
+/*
+ * A set of shell patterns compiled into one DFA over bytes, so that a
+ * string is tested against all of them in a single pass. Patterns
+ * follow fnmatch(3) with no flags in the C locale: '*' and '?' match
+ * any byte including '/' and a leading '.', brackets take ranges,
+ * '!' or '^' negation and [:class:], and '\' escapes; malformed brackets
+ * fail or read as a literal '[' just where glibc's do. The DFA is built
+ * up front by compile() and is read only after, so matching needs no
+ * locking. Bytes that no pattern tells apart share a column of the
+ * transition table.
+ */
+class glob_set {
+  public:
+    glob_set();
+
+    void add(const std::string &pattern);
+    /* text matches only itself */
+    void add_literal(const std::string &text);
+    /* Call after the last add, before matching. */
+    void compile();
+
+    bool empty() const {
+      return m_base.empty();
+    }
+    /* True if some pattern matches the whole of text. */
+    bool match(const char *text, size_t length) const;
+    bool match(const std::string &text) const {
+      return match(text.data(), text.length());
+    }
+    /* True if some pattern matches a whole '/' or '\' separated
+     * component of path; empty components never match. */
+    bool match_component(const std::string &path) const;
+  protected:
+    typedef uint32_t state;
+    /* a byte from a set, or any run of bytes */
+    struct token {
+      bool star;
+      std::bitset<256> bytes;
+    };
+
+    static void add_token(std::vector<token> &tokens, const token &next);
+    void add_tokens(const std::vector<token> &tokens);
+    void add_from(const std::string &pattern, size_t pos, std::vector<token> tokens);
+    void closure(std::vector<uint32_t> &positions) const;
+    void step(const std::vector<uint32_t> &from, unsigned char byte, std::vector<uint32_t> &to) const;
+    bool accepting(const std::vector<uint32_t> &positions) const;
+    bool simulate(const char *text, size_t length) const;
+
+    /* every pattern's tokens, the end of each marked by m_end */
+    std::vector<token> m_tokens;
+    std::vector<bool> m_end;
+    std::vector<uint32_t> m_base;
+
+    /* DFA: state 0 is dead, state 1 the start */
+    bool m_compiled;
+    unsigned char m_class[256];
+    size_t m_classes;
+    std::vector<state> m_next;
+    std::vector<bool> m_accept;
+};
+
+#endif//GLOB_SET_H
@@ -0,0 +1,183 @@
+#include "hash_cache.h"
+
+#include <cstring>
+
+/* Rows written per transaction. */
+#define CACHE_BATCH 10000
+
+/* An upsert's row and the stored one are of the same file version;
+ * checksums the run did not get to then keep their stored values. */
+#define SAME_VERSION "size=excluded.size AND mtime=excluded.mtime AND ctime=excluded.ctime"
+
+hash_cache::hash_cache()
+  : m_db(NULL), m_select(NULL), m_store(NULL), m_lock(), m_pending(0), m_hits(0)
+{}
+
+hash_cache::~hash_cache() {
+  close();
+}
+
+bool hash_cache::exec(const char *sql) {
+  char *error = NULL;
+  if(sqlite3_exec(m_db, sql, NULL, NULL, &error)!=SQLITE_OK) {
+    errormsg("checksum cache: %s\n", error ? error : sqlite3_errmsg(m_db));
+    sqlite3_free(error);
+    return false;
+  }
+  return true;
+}
+
+bool hash_cache::has_column(const char *name) {
+  std::string sql = std::string("SELECT ") + name + " FROM hashes LIMIT 0;";
+  sqlite3_stmt *probe = NULL;
+  bool found = sqlite3_prepare_v2(m_db, sql.c_str(), -1, &probe, NULL)==SQLITE_OK;
+  sqlite3_finalize(probe);
+  return found;
+}
+
+bool hash_cache::open(const std::string &filename) {
+  close();
+  if(sqlite3_open(filename.c_str(), &m_db)!=SQLITE_OK) {
+    errormsg("could not open checksum cache %s: %s\n", filename.c_str(), sqlite3_errmsg(m_db));
+    close();
+    return false;
+  }
+  sqlite3_busy_timeout(m_db, 5000);
+  /* The cache can always be rebuilt, so durability is not worth fsyncs. */
+  if(!exec("PRAGMA journal_mode=WAL; PRAGMA synchronous=OFF;")) {
+    close();
+    return false;
+  }
+  /* older caches kept mtime to the second and no ctime; their rows
+   * cannot be validated, so start again */
+  if(has_column("size") && !has_column("ctime") && !exec("DROP TABLE hashes;")) {
+    close();
+    return false;
+  }
+  /* mtime and ctime in nanoseconds */
+  if(!exec("CREATE TABLE IF NOT EXISTS hashes ("
+           " device INTEGER NOT NULL, inode INTEGER NOT NULL,"
+           " size INTEGER NOT NULL, mtime INTEGER NOT NULL, ctime INTEGER NOT NULL,"
+           " partial_size INTEGER, crcpartial INTEGER, crcfull INTEGER,"
+           " digest_type TEXT, digest BLOB,"
+           " PRIMARY KEY (device, inode));")) {
+    close();
+    return false;
+  }
+  if(sqlite3_prepare_v2(m_db, "SELECT size, mtime, ctime, partial_size, crcpartial, crcfull, digest_type, digest FROM hashes WHERE device=? AND inode=?;", -1, &m_select, NULL)!=SQLITE_OK ||
+     sqlite3_prepare_v2(m_db, "INSERT INTO hashes (device, inode, size, mtime, ctime, partial_size, crcpartial, crcfull, digest_type, digest)"
+                        " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"
+                        " ON CONFLICT(device, inode) DO UPDATE SET"
+                        " partial_size=CASE WHEN " SAME_VERSION " AND excluded.crcpartial IS NULL THEN partial_size ELSE excluded.partial_size END,"
+                        " crcpartial=CASE WHEN " SAME_VERSION " THEN COALESCE(excluded.crcpartial, crcpartial) ELSE excluded.crcpartial END,"
+                        " crcfull=CASE WHEN " SAME_VERSION " THEN COALESCE(excluded.crcfull, crcfull) ELSE excluded.crcfull END,"
+                        " digest_type=CASE WHEN " SAME_VERSION " AND excluded.digest IS NULL THEN digest_type ELSE excluded.digest_type END,"
+                        " digest=CASE WHEN " SAME_VERSION " THEN COALESCE(excluded.digest, digest) ELSE excluded.digest END,"
+                        " size=excluded.size, mtime=excluded.mtime, ctime=excluded.ctime;", -1, &m_store, NULL)!=SQLITE_OK) {
+    errormsg("checksum cache: %s\n", sqlite3_errmsg(m_db));
+    close();
+    return false;
+  }
+  return exec("BEGIN;");
+}
+
+void hash_cache::commit() {
+  exec("COMMIT;");
+  m_pending = 0;
+}
+
+void hash_cache::flush() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if(m_db==NULL || m_pending==0) return;
+  commit();
+  exec("BEGIN;");
+}
+
+void hash_cache::close() {
+  if(m_db==NULL) return;
+  if(m_select!=NULL && m_store!=NULL) commit();
+  sqlite3_finalize(m_select);
+  sqlite3_finalize(m_store);
+  sqlite3_close(m_db);
+  m_db = NULL;
+  m_select = NULL;
+  m_store = NULL;
+}
+
+bool hash_cache::lookup(file_store &files, file_id id) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if(m_db==NULL) return false;
+
+  bool found = false;
+  sqlite3_bind_int64(m_select, 1, (sqlite3_int64)files.device(id));
+  sqlite3_bind_int64(m_select, 2, (sqlite3_int64)files.inode(id));
+  if(sqlite3_step(m_select)==SQLITE_ROW &&
+     sqlite3_column_int64(m_select, 0)==(sqlite3_int64)files.size(id) &&
+     sqlite3_column_int64(m_select, 1)==files.mtime(id) &&
+     sqlite3_column_int64(m_select, 2)==files.ctime(id)) {
+    /* partial checksums depend on how much of the file was read */
+    if(sqlite3_column_type(m_select, 4)!=SQLITE_NULL && sqlite3_column_int64(m_select, 3)==MAX_PARTIAL_SIZE) {
+      files.set_crcpartial(id, (uint32_t)sqlite3_column_int64(m_select, 4));
+      found = true;
+    }
+    if(sqlite3_column_type(m_select, 5)!=SQLITE_NULL) {
+      files.set_crcfull(id, (uint32_t)sqlite3_column_int64(m_select, 5));
+      found = true;
+    }
+    /* digests are only of use to a run asking for the same kind */
+    const char *digest_type = (const char *)sqlite3_column_text(m_select, 6);
+    if(files.digest_type()!=DIGEST_NONE && digest_type!=NULL &&
+       strcmp(digest_type, digest_context::kind_name(files.digest_type()))==0 &&
+       sqlite3_column_bytes(m_select, 7)==DIGEST_SIZE) {
+      digest_t digest;
+      memcpy(digest.bytes, sqlite3_column_blob(m_select, 7), DIGEST_SIZE);
+      files.set_digest(id, digest);
+      found = true;
+    }
+  }
+  sqlite3_reset(m_select);
+  if(found) m_hits++;
+  return found;
+}
+
+void hash_cache::store(const file_store &files, file_id id) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if(m_db==NULL) return;
+
+  sqlite3_bind_int64(m_store, 1, (sqlite3_int64)files.device(id));
+  sqlite3_bind_int64(m_store, 2, (sqlite3_int64)files.inode(id));
+  sqlite3_bind_int64(m_store, 3, (sqlite3_int64)files.size(id));
+  sqlite3_bind_int64(m_store, 4, files.mtime(id));
+  sqlite3_bind_int64(m_store, 5, files.ctime(id));
+  class crc32 crcpartial = files.crcpartial(id);
+  class crc32 crcfull = files.crcfull(id);
+  if(crcpartial.valid) {
+    sqlite3_bind_int64(m_store, 6, MAX_PARTIAL_SIZE);
+    sqlite3_bind_int64(m_store, 7, crcpartial.crc);
+  } else {
+    sqlite3_bind_null(m_store, 6);
+    sqlite3_bind_null(m_store, 7);
+  }
+  if(crcfull.valid) {
+    sqlite3_bind_int64(m_store, 8, crcfull.crc);
+  } else {
+    sqlite3_bind_null(m_store, 8);
+  }
+  digest_t digest;
+  if(files.digest_type()!=DIGEST_NONE && files.digest(id, digest)) {
+    sqlite3_bind_text(m_store, 9, digest_context::kind_name(files.digest_type()), -1, SQLITE_STATIC);
+    sqlite3_bind_blob(m_store, 10, digest.bytes, DIGEST_SIZE, SQLITE_TRANSIENT);
+  } else {
+    sqlite3_bind_null(m_store, 9);
+    sqlite3_bind_null(m_store, 10);
+  }
+  if(sqlite3_step(m_store)!=SQLITE_DONE) {
+    errormsg("checksum cache: %s\n", sqlite3_errmsg(m_db));
+  }
+  sqlite3_reset(m_store);
+
+  if(++m_pending>=CACHE_BATCH) {
+    commit();
+    exec("BEGIN;");
+  }
+}
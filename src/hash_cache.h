@@ -0,0 +1,58 @@
+#ifndef HASH_CACHE_H
+#define HASH_CACHE_H
+
+#include <mutex>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "fdupes.h"
+#include "file_store.h"
+
+/*
+ * Persistent checksum cache. Rows are keyed by (device, inode) and only
+ * trusted while the file's size, mtime and ctime are unchanged to the
+ * nanosecond, so a rerun over a mostly static tree never has to open
+ * the files again. Restoring an mtime with touch -r still moves the
+ * ctime on. All methods
+ * are safe to call from several threads; writes are batched into
+ * transactions.
+ */
+class hash_cache {
+  public:
+    hash_cache();
+    hash_cache(const hash_cache &)=delete;
+    hash_cache &operator=(const hash_cache &)=delete;
+    ~hash_cache();
+
+    bool open(const std::string &filename);
+    void close();
+    bool is_open() const {
+      return m_db!=NULL;
+    }
+
+    /* Fill in any checksums recorded for this exact file version. */
+    bool lookup(file_store &files, file_id id);
+    /* Record the file's valid checksums, keeping those stored for the
+     * same version of the file that this run did not compute. */
+    void store(const file_store &files, file_id id);
+    /* Commit what has been stored so far. */
+    void flush();
+
+    size_t hits() const {
+      return m_hits;
+    }
+  protected:
+    bool exec(const char *sql);
+    bool has_column(const char *name);
+    void commit();
+
+    sqlite3 *m_db;
+    sqlite3_stmt *m_select;
+    sqlite3_stmt *m_store;
+    std::mutex m_lock;
+    size_t m_pending;
+    size_t m_hits;
+};
+
+#endif//HASH_CACHE_H
@@ -0,0 +1,87 @@
+#include "io_scheduler.h"
+
+#include <cstdio>
+
+#include <sys/sysmacros.h>
+
+io_scheduler::io_scheduler()
+  : m_lock(), m_devices()
+{}
+
+unsigned int io_scheduler::detect_depth(dev_t device) {
+  char path[64];
+  /* a partition's queue belongs to the disk one level up */
+  const char *candidates[] = { "/sys/dev/block/%u:%u/queue/rotational", "/sys/dev/block/%u:%u/../queue/rotational" };
+  for(size_t i=0; i<sizeof(candidates)/sizeof(candidates[0]); i++) {
+    snprintf(path, sizeof(path), candidates[i], major(device), minor(device));
+    FILE *fp = fopen(path, "r");
+    if(fp==NULL) continue;
+    int rotational = 0;
+    bool found = fscanf(fp, "%d", &rotational)==1;
+    fclose(fp);
+    if(found) return rotational ? ROTATIONAL_DEPTH : UNLIMITED_DEPTH;
+  }
+  /* network and virtual filesystems have no block queue */
+  return UNLIMITED_DEPTH;
+}
+
+io_scheduler::device_queue &io_scheduler::queue(dev_t device) {
+  auto it = m_devices.find(device);
+  if(it==m_devices.end()) {
+    it = m_devices.insert(std::make_pair(device, device_queue(detect_depth(device)))).first;
+  }
+  return it->second;
+}
+
+void io_scheduler::set_depth(dev_t device, unsigned int depth) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  auto it = m_devices.find(device);
+  if(it==m_devices.end()) {
+    m_devices.insert(std::make_pair(device, device_queue(depth)));
+  } else {
+    it->second.depth = depth;
+  }
+}
+
+unsigned int io_scheduler::depth(dev_t device) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  return queue(device).depth;
+}
+
+void io_scheduler::run(task_group &tasks, dev_t device, std::function<void()> task) {
+  tasks.reserve();
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    device_queue &q = queue(device);
+    if(q.depth!=UNLIMITED_DEPTH && q.active>=q.depth) {
+      waiting_task waiting = { &tasks, std::move(task) };
+      q.waiting.push_back(std::move(waiting));
+      return;
+    }
+    q.active++;
+  }
+  dispatch(tasks, device, std::move(task));
+}
+
+void io_scheduler::dispatch(task_group &tasks, dev_t device, std::function<void()> task) {
+  tasks.run_reserved([this, device, task]() {
+    task();
+    finished(device);
+  });
+}
+
+void io_scheduler::finished(dev_t device) {
+  waiting_task next;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    device_queue &q = queue(device);
+    if(q.waiting.empty()) {
+      q.active--;
+      return;
+    }
+    /* hand the slot straight to the next read in line */
+    next = std::move(q.waiting.front());
+    q.waiting.pop_front();
+  }
+  dispatch(*next.tasks, device, std::move(next.task));
+}
@@ -0,0 +1,62 @@
+#ifndef IO_SCHEDULER_H
+#define IO_SCHEDULER_H
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
+#include <sys/types.h>
+
+#include "thread_pool.h"
+
+/* Reads in flight on a spinning disk, unless configured otherwise. */
+#define ROTATIONAL_DEPTH 2
+/* No limit beyond the size of the thread pool. */
+#define UNLIMITED_DEPTH  0
+
+/*
+ * Per-device I/O queues. Every read is tagged with the st_dev of the
+ * file it touches, and at most depth reads per device are handed to
+ * the thread pool at once; the rest wait in their device's queue, in
+ * order, until an earlier read on that device finishes. A slow disk
+ * thus cannot tie up the threads that would keep a fast one busy.
+ *
+ * Devices without a configured depth are looked up once in sysfs:
+ * ROTATIONAL_DEPTH if queue/rotational says the disk spins, otherwise
+ * unlimited.
+ */
+class io_scheduler {
+  public:
+    io_scheduler();
+    io_scheduler(const io_scheduler &)=delete;
+    io_scheduler &operator=(const io_scheduler &)=delete;
+
+    void set_depth(dev_t device, unsigned int depth);
+    unsigned int depth(dev_t device);
+
+    /* Run task as part of tasks once device has a free slot. */
+    void run(task_group &tasks, dev_t device, std::function<void()> task);
+
+    static unsigned int detect_depth(dev_t device);
+  protected:
+    struct waiting_task {
+      task_group *tasks;
+      std::function<void()> task;
+    };
+    struct device_queue {
+      device_queue(unsigned int _depth): depth(_depth), active(0), waiting() {}
+      unsigned int depth;
+      unsigned int active;
+      std::deque<waiting_task> waiting;
+    };
+
+    device_queue &queue(dev_t device);
+    void dispatch(task_group &tasks, dev_t device, std::function<void()> task);
+    void finished(dev_t device);
+
+    std::mutex m_lock;
+    std::map<dev_t, device_queue> m_devices;
+};
+
+#endif//IO_SCHEDULER_H
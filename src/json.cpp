@@ -0,0 +1,71 @@
+#include "json.h"
+
+#include <cstdint>
+#include <cstdio>
+
+bool json_valid_utf8(const std::string &value) {
+  const unsigned char *p = (const unsigned char *)value.data();
+  const unsigned char *end = p + value.length();
+  while(p < end) {
+    size_t extra;
+    uint32_t code;
+    if(*p < 0x80) {
+      p++;
+      continue;
+    } else if((*p & 0xe0) == 0xc0) {
+      extra = 1;
+      code = *p & 0x1f;
+    } else if((*p & 0xf0) == 0xe0) {
+      extra = 2;
+      code = *p & 0x0f;
+    } else if((*p & 0xf8) == 0xf0) {
+      extra = 3;
+      code = *p & 0x07;
+    } else {
+      return false;
+    }
+    if((size_t)(end - p) <= extra) return false;
+    for(size_t i=1; i<=extra; i++) {
+      if((p[i] & 0xc0) != 0x80) return false;
+      code = (code << 6) | (p[i] & 0x3f);
+    }
+    /* overlong forms, surrogates and values past U+10FFFF */
+    static const uint32_t minimum[] = { 0, 0x80, 0x800, 0x10000 };
+    if(code < minimum[extra] || (code >= 0xd800 && code <= 0xdfff) || code > 0x10ffff) return false;
+    p += extra + 1;
+  }
+  return true;
+}
+
+void json_append_string(std::string &out, const std::string &value) {
+  out.push_back('"');
+  for(auto it=value.begin(); it!=value.end(); ++it) {
+    unsigned char c = *it;
+    switch(c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if(c < 0x20) {
+          char escape[8];
+          snprintf(escape, sizeof(escape), "\\u%04x", c);
+          out += escape;
+        } else {
+          out.push_back(c);
+        }
+    }
+  }
+  out.push_back('"');
+}
+
+void json_append_hex(std::string &out, const unsigned char *data, size_t length) {
+  static const char digits[] = "0123456789abcdef";
+  out.push_back('"');
+  for(size_t i=0; i<length; i++) {
+    out.push_back(digits[data[i] >> 4]);
+    out.push_back(digits[data[i] & 0xf]);
+  }
+  out.push_back('"');
+}
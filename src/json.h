@@ -0,0 +1,16 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdlib>
+#include <string>
+
+/* Does value hold well-formed UTF-8, as JSON strings must? */
+bool json_valid_utf8(const std::string &value);
+
+/* Append value as a quoted JSON string; value must be valid UTF-8. */
+void json_append_string(std::string &out, const std::string &value);
+
+/* Append data as a quoted string of lowercase hex digits. */
+void json_append_hex(std::string &out, const unsigned char *data, size_t length);
+
+#endif//JSON_H
@@ -0,0 +1,60 @@
+#include "perf_stats.h"
+
+static const char *stage_names[STAGES] = { "size", "partial", "sample", "full", "compare" };
+static const char *phase_names[PHASES] = { "scan", "group", "prehash", "match", "action" };
+
+static double seconds(uint64_t nanoseconds) {
+  return nanoseconds / 1e9;
+}
+
+perf_stats::perf_stats()
+  : m_enabled(false), m_directories(0), m_stats(0)
+{
+  for(int i=0; i<STAGES; i++) {
+    m_files[i] = 0;
+    m_bytes[i] = 0;
+    m_eliminated[i] = 0;
+    m_busy[i] = 0;
+  }
+  for(int i=0; i<PHASES; i++) {
+    m_phase[i] = 0;
+  }
+}
+
+void perf_stats::report(FILE *out, bool json, uint64_t files_scanned) const {
+  double scan = seconds(m_phase[PHASE_SCAN]);
+  double rate = scan>0 ? files_scanned / scan : 0.0;
+  uint64_t total = 0;
+  for(int i=0; i<PHASES; i++) {
+    total += m_phase[i];
+  }
+
+  if(json) {
+    fprintf(out, "{\"files_scanned\":%llu,\"directories\":%llu,\"stat_calls\":%llu,\"files_per_second\":%.1f,\"seconds\":%.6f",
+        (unsigned long long)files_scanned, (unsigned long long)m_directories.load(), (unsigned long long)m_stats.load(), rate, seconds(total));
+    fprintf(out, ",\"phases\":{");
+    for(int i=0; i<PHASES; i++) {
+      fprintf(out, "%s\"%s\":%.6f", i ? "," : "", phase_names[i], seconds(m_phase[i]));
+    }
+    fprintf(out, "},\"stages\":{");
+    for(int i=0; i<STAGES; i++) {
+      fprintf(out, "%s\"%s\":{\"files\":%llu,\"bytes\":%llu,\"busy_seconds\":%.6f,\"eliminated\":%llu}", i ? "," : "", stage_names[i],
+          (unsigned long long)m_files[i].load(), (unsigned long long)m_bytes[i].load(), seconds(m_busy[i]), (unsigned long long)m_eliminated[i].load());
+    }
+    fprintf(out, "}}\n");
+    return;
+  }
+
+  fprintf(out, "%llu files in %llu directories, %llu stat calls, %.0f files/s\n",
+      (unsigned long long)files_scanned, (unsigned long long)m_directories.load(), (unsigned long long)m_stats.load(), rate);
+  fprintf(out, "%-8s %10s\n", "phase", "seconds");
+  for(int i=0; i<PHASES; i++) {
+    fprintf(out, "%-8s %10.3f\n", phase_names[i], seconds(m_phase[i]));
+  }
+  fprintf(out, "%-8s %10.3f\n", "total", seconds(total));
+  fprintf(out, "%-8s %10s %12s %10s %10s\n", "stage", "files", "MB read", "busy s", "ruled out");
+  for(int i=0; i<STAGES; i++) {
+    fprintf(out, "%-8s %10llu %12.1f %10.3f %10llu\n", stage_names[i], (unsigned long long)m_files[i].load(),
+        m_bytes[i].load() / (1024.0 * 1024.0), seconds(m_busy[i]), (unsigned long long)m_eliminated[i].load());
+  }
+}
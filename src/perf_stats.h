@@ -0,0 +1,128 @@
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+/* Stages a candidate goes through; each one reads, and rules some out. */
+enum perf_stage {
+  STAGE_SIZE,      /* unique sizes: never read */
+  STAGE_PARTIAL,   /* first MAX_PARTIAL_SIZE bytes */
+  STAGE_SAMPLE,    /* sampled blocks (--sample) */
+  STAGE_FULL,      /* full CRC or strong digest */
+  STAGE_COMPARE,   /* byte comparison */
+  STAGES
+};
+
+/* Consecutive phases of a run, timed on the wall clock. */
+enum perf_phase {
+  PHASE_SCAN,
+  PHASE_GROUP,     /* sorting into size buckets, cache lookups */
+  PHASE_PREHASH,   /* -u and -P passes */
+  PHASE_MATCH,
+  PHASE_ACTION,    /* printing, deleting or deduplicating */
+  PHASES
+};
+
+/*
+ * Counters and timers for --stats. Counting is a relaxed atomic add
+ * per file or per call, cheap enough to be always on; stage timers
+ * only read the clock once enable() has been called. Stage time is
+ * summed over threads, so with -j it can exceed the wall time.
+ */
+class perf_stats {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    perf_stats();
+    perf_stats(const perf_stats &)=delete;
+    perf_stats &operator=(const perf_stats &)=delete;
+
+    void enable() {
+      m_enabled = true;
+    }
+    bool enabled() const {
+      return m_enabled;
+    }
+
+    void add_directory() {
+      m_directories.fetch_add(1, std::memory_order_relaxed);
+    }
+    void add_stat() {
+      m_stats.fetch_add(1, std::memory_order_relaxed);
+    }
+    /* bytes read at stage; files counts the files newly opened */
+    void add_read(perf_stage stage, uint64_t bytes, uint64_t files=1) {
+      m_files[stage].fetch_add(files, std::memory_order_relaxed);
+      m_bytes[stage].fetch_add(bytes, std::memory_order_relaxed);
+    }
+    /* Candidates ruled out at stage. */
+    void add_eliminated(perf_stage stage, uint64_t count) {
+      m_eliminated[stage].fetch_add(count, std::memory_order_relaxed);
+    }
+    void add_busy(perf_stage stage, clock::duration elapsed) {
+      m_busy[stage].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+    }
+    void add_phase(perf_phase phase, clock::duration elapsed) {
+      m_phase[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+    /* Bytes read so far, over all stages. */
+    uint64_t bytes_read() const {
+      uint64_t total = 0;
+      for(int i=0; i<STAGES; i++) {
+        total += m_bytes[i].load(std::memory_order_relaxed);
+      }
+      return total;
+    }
+
+    /* Write everything counted, as a table or one JSON object. */
+    void report(FILE *out, bool json, uint64_t files_scanned) const;
+  protected:
+    bool m_enabled;
+    std::atomic<uint64_t> m_directories;
+    std::atomic<uint64_t> m_stats;
+    std::atomic<uint64_t> m_files[STAGES];
+    std::atomic<uint64_t> m_bytes[STAGES];
+    std::atomic<uint64_t> m_eliminated[STAGES];
+    std::atomic<uint64_t> m_busy[STAGES];
+    uint64_t m_phase[PHASES];
+};
+
+extern perf_stats stats;
+
+/* Adds the time until it goes out of scope to a stage, when enabled. */
+class stage_timer {
+  public:
+    explicit stage_timer(perf_stage stage)
+      : m_stage(stage), m_start(stats.enabled() ? perf_stats::clock::now() : perf_stats::clock::time_point())
+    {}
+    stage_timer(const stage_timer &)=delete;
+    stage_timer &operator=(const stage_timer &)=delete;
+    ~stage_timer() {
+      if(stats.enabled()) stats.add_busy(m_stage, perf_stats::clock::now() - m_start);
+    }
+  protected:
+    perf_stage m_stage;
+    perf_stats::clock::time_point m_start;
+};
+
+/* Adds the time until it goes out of scope to a phase. */
+class phase_timer {
+  public:
+    explicit phase_timer(perf_phase phase)
+      : m_phase(phase), m_start(perf_stats::clock::now())
+    {}
+    phase_timer(const phase_timer &)=delete;
+    phase_timer &operator=(const phase_timer &)=delete;
+    ~phase_timer() {
+      stats.add_phase(m_phase, perf_stats::clock::now() - m_start);
+    }
+  protected:
+    perf_phase m_phase;
+    perf_stats::clock::time_point m_start;
+};
+
+#endif//PERF_STATS_H
@@ -0,0 +1,63 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include "io_scheduler.h"
+#include "thread_pool.h"
+
+/*
+ * Runs the shape of the match phase: one task per bucket queued at the
+ * start, each waiting on a nested group of reads that a depth 1 device
+ * holds back. A waiting thread must not start other buckets on its own
+ * stack, so with one thread only one bucket may ever be open at a time,
+ * and with more at most one per thread.
+ */
+
+#define BUCKETS 200000
+#define READS 3
+
+static int check(unsigned int threads) {
+  const dev_t device = 1;
+  thread_pool pool(threads);
+  io_scheduler io_queues;
+  io_queues.set_depth(device, 1);
+
+  std::atomic<size_t> open(0), most_open(0), reads(0);
+  {
+    task_group buckets(pool);
+    for(size_t i=0; i<BUCKETS; i++) {
+      buckets.run([&]() {
+        size_t now = ++open;
+        for(size_t most=most_open; now>most && !most_open.compare_exchange_weak(most, now); );
+        task_group tasks(pool);
+        for(int r=0; r<READS; r++) {
+          io_queues.run(tasks, device, [&reads]() { reads++; });
+        }
+        tasks.wait();
+        open--;
+      });
+    }
+    buckets.wait();
+  }
+
+  int failures = 0;
+  if(reads!=(size_t)BUCKETS * READS) {
+    fprintf(stderr, "%u threads: %zu reads, expected %zu\n", threads, reads.load(), (size_t)BUCKETS * READS);
+    failures++;
+  }
+  if(most_open>threads) {
+    fprintf(stderr, "%u threads: %zu buckets open at once\n", threads, most_open.load());
+    failures++;
+  }
+  printf("%u threads: %zu buckets open at most\n", threads, most_open.load());
+  return failures;
+}
+
+int main(int, char *[]) {
+  int failures = check(1) + check(4);
+  return failures == 0 ? 0 : 1;
+}
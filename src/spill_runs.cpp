@@ -0,0 +1,222 @@
+#include "spill_runs.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <queue>
+
+#include <unistd.h>
+
+#include "fdupes.h"
+
+/* Read buffer given to each run while merging. */
+#define SPILL_READ (size_t)(64*1024)
+
+/* Larger sizes first, then the order the files were added in. */
+static bool spilled_before(const spilled_file &a, const spilled_file &b) {
+  if(a.size!=b.size) return a.size > b.size;
+  return a.sequence < b.sequence;
+}
+
+static bool write_record(FILE *out, const spilled_file &file, const char *name) {
+  if(fwrite(&file, sizeof(file), 1, out)!=1) return false;
+  return file.name_length==0 || fwrite(name, file.name_length, 1, out)==1;
+}
+
+spill_runs::spill_runs(const std::string &directory)
+  : m_directory(directory), m_buffer(), m_records(), m_runs(), m_levels(), m_sequence(0), m_failed(false)
+{
+  /* a little over a run, so the buffer never has to grow */
+  m_buffer.reserve(SPILL_RUN + sizeof(spilled_file) + 4096);
+}
+
+spill_runs::~spill_runs() {
+  for(auto it=m_runs.begin(); it!=m_runs.end(); ++it) {
+    close(*it);
+  }
+}
+
+void spill_runs::fail(const char *what) {
+  if(!m_failed) errormsg("%s run file in %s: %s\n", what, m_directory.c_str(), strerror(errno));
+  m_failed = true;
+}
+
+void spill_runs::add(uint32_t dir, const char *name, off_t size, dev_t device, ino_t inode, int64_t mtime, int64_t ctime) {
+  spilled_file file;
+  file.size = size;
+  file.device = device;
+  file.inode = inode;
+  file.mtime = mtime;
+  file.ctime = ctime;
+  file.sequence = m_sequence++;
+  file.dir = dir;
+  file.name_length = strlen(name);
+
+  m_records.push_back(m_buffer.size());
+  const char *record = (const char *)&file;
+  m_buffer.insert(m_buffer.end(), record, record + sizeof(file));
+  m_buffer.insert(m_buffer.end(), name, name + file.name_length);
+  /* keep the next record aligned */
+  m_buffer.resize((m_buffer.size() + 7) & ~(size_t)7);
+  if(m_buffer.size() >= SPILL_RUN) write_run();
+}
+
+FILE *spill_runs::create_run() {
+  /* unlinked straight away, so the run goes however we exit */
+  std::string name = m_directory + "/fdupes-run-XXXXXX";
+  std::vector<char> path(name.begin(), name.end());
+  path.push_back('\0');
+  int fd = mkstemp(path.data());
+  if(fd<0) {
+    fail("could not create");
+    return NULL;
+  }
+  unlink(path.data());
+
+  /* the run keeps its own descriptor, to be read back through */
+  int out_fd = dup(fd);
+  FILE *out = out_fd<0 ? NULL : fdopen(out_fd, "w");
+  if(out==NULL) {
+    if(out_fd>=0) close(out_fd);
+    close(fd);
+    fail("could not write");
+    return NULL;
+  }
+  m_runs.push_back(fd);
+  m_levels.push_back(0);
+  return out;
+}
+
+void spill_runs::write_run() {
+  if(m_records.empty() || m_failed) return;
+
+  const char *buffer = m_buffer.data();
+  std::sort(m_records.begin(), m_records.end(), [buffer](size_t a, size_t b) {
+    return spilled_before(*(const spilled_file *)(buffer + a), *(const spilled_file *)(buffer + b));
+  });
+  FILE *out = create_run();
+  if(out==NULL) return;
+  bool ok = true;
+  for(auto it=m_records.begin(); it!=m_records.end() && ok; ++it) {
+    const spilled_file *file = (const spilled_file *)(buffer + *it);
+    ok = write_record(out, *file, (const char *)(file + 1));
+  }
+  if(fclose(out)!=0 || !ok) fail("could not write");
+
+  m_records.clear();
+  m_buffer.clear();
+  compact();
+}
+
+/*
+ * Levels never increase along m_runs, so runs of one level are always
+ * the last ones. Whenever SPILL_FANIN of them have built up they are
+ * merged into one run of the next level, and every record is rewritten
+ * only once per level.
+ */
+void spill_runs::compact() {
+  while(!m_failed && m_runs.size() >= SPILL_FANIN) {
+    size_t first = m_runs.size() - SPILL_FANIN;
+    unsigned int level = m_levels.back();
+    if(m_levels[first]!=level) break;
+
+    std::vector<int> runs(m_runs.begin() + first, m_runs.end());
+    m_runs.resize(first);
+    m_levels.resize(first);
+    FILE *out = create_run();
+    if(out==NULL) {
+      for(auto it=runs.begin(); it!=runs.end(); ++it) {
+        close(*it);
+      }
+      return;
+    }
+    m_levels.back() = level + 1;
+    bool ok = true;
+    merge_runs(runs, [out, &ok](const spilled_file &file, const std::string &name) {
+      ok = ok && write_record(out, file, name.data());
+    });
+    if(fclose(out)!=0 || !ok) fail("could not write");
+  }
+}
+
+bool spill_runs::merge_runs(std::vector<int> &runs, std::function<void(const spilled_file &, const std::string &)> emit) {
+  struct head {
+    spilled_file file;
+    std::string name;
+    FILE *run;
+  };
+  std::vector<head> heads(runs.size());
+  std::vector<std::unique_ptr<char[]>> buffers;
+  auto next = [this](head &h) {
+    if(fread(&h.file, sizeof(h.file), 1, h.run)!=1) {
+      if(ferror(h.run)) fail("could not read");
+      return false;
+    }
+    h.name.resize(h.file.name_length);
+    if(h.file.name_length>0 && fread(&h.name[0], h.file.name_length, 1, h.run)!=1) {
+      errno = EIO;
+      fail("truncated");
+      return false;
+    }
+    return true;
+  };
+  auto later = [&heads](size_t a, size_t b) {
+    return spilled_before(heads[b].file, heads[a].file);
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(later)> queue(later);
+  for(size_t i=0; i<runs.size(); i++) {
+    heads[i].run = NULL;
+    if(lseek(runs[i], 0, SEEK_SET)==0) heads[i].run = fdopen(runs[i], "r");
+    if(heads[i].run==NULL) {
+      close(runs[i]);
+      fail("could not read");
+      continue;
+    }
+    buffers.push_back(std::unique_ptr<char[]>(new char[SPILL_READ]));
+    setvbuf(heads[i].run, buffers.back().get(), _IOFBF, SPILL_READ);
+    if(next(heads[i])) queue.push(i);
+  }
+  runs.clear();
+
+  while(!queue.empty()) {
+    head &h = heads[queue.top()];
+    queue.pop();
+    emit(h.file, h.name);
+    if(next(h)) queue.push(&h - &heads[0]);
+  }
+
+  for(auto it=heads.begin(); it!=heads.end(); ++it) {
+    if(it->run!=NULL) fclose(it->run);
+  }
+  return !m_failed;
+}
+
+bool spill_runs::merge(std::function<void(const spilled_file &, const char *)> keep) {
+  write_run();
+  std::vector<char>().swap(m_buffer);
+  std::vector<size_t>().swap(m_records);
+  if(m_failed) return false;
+
+  /* files of one size are held until we know there is more than one */
+  std::vector<spilled_file> group;
+  std::vector<std::string> names;
+  auto flush = [&]() {
+    if(group.size()>1) {
+      for(size_t i=0; i<group.size(); i++) {
+        keep(group[i], names[i].c_str());
+      }
+    }
+    group.clear();
+    names.clear();
+  };
+  m_levels.clear();
+  merge_runs(m_runs, [&](const spilled_file &file, const std::string &name) {
+    if(!group.empty() && group.back().size!=file.size) flush();
+    group.push_back(file);
+    names.push_back(name);
+  });
+  flush();
+  return !m_failed;
+}
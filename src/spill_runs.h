@@ -0,0 +1,71 @@
+#ifndef SPILL_RUNS_H
+#define SPILL_RUNS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+/* Bytes of records buffered before they are sorted and written out. */
+#define SPILL_RUN (size_t)(16*1024*1024)
+/* Runs of one level merged together into one of the next. */
+#define SPILL_FANIN 128
+
+/* One scanned file as written to a run. */
+struct spilled_file {
+  int64_t size;
+  uint64_t device;
+  uint64_t inode;
+  int64_t mtime;       /* nanoseconds */
+  int64_t ctime;
+  uint64_t sequence;   /* order added, to break ties in size */
+  uint32_t dir;
+  uint32_t name_length;
+};
+
+/*
+ * External sort of scan records by size. Records are buffered until
+ * SPILL_RUN bytes are held, then sorted (largest size first, in the
+ * order added within a size) and written to an unlinked temporary
+ * file; every SPILL_FANIN runs of one level are merged into one.
+ * merge() reads the runs back together and passes on only the files
+ * whose size is shared by another, so files of unique size, the vast
+ * majority, never need to be held in memory at all.
+ *
+ * Used from one thread. Errors are reported once through errormsg().
+ */
+class spill_runs {
+  public:
+    explicit spill_runs(const std::string &directory);
+    spill_runs(const spill_runs &)=delete;
+    spill_runs &operator=(const spill_runs &)=delete;
+    ~spill_runs();
+
+    void add(uint32_t dir, const char *name, off_t size, dev_t device, ino_t inode, int64_t mtime, int64_t ctime);
+    /* Call keep(file, name) for each file sharing its size, largest
+     * first; false if a run could not be written or read back. */
+    bool merge(std::function<void(const spilled_file &, const char *)> keep);
+
+    size_t runs() const {
+      return m_runs.size();
+    }
+  protected:
+    FILE *create_run();
+    void write_run();
+    void compact();
+    bool merge_runs(std::vector<int> &runs, std::function<void(const spilled_file &, const std::string &)> emit);
+    void fail(const char *what);
+
+    std::string m_directory;
+    std::vector<char> m_buffer;
+    std::vector<size_t> m_records;
+    std::vector<int> m_runs;   /* descriptors of unlinked run files */
+    std::vector<unsigned int> m_levels;   /* merges each run went through */
+    uint64_t m_sequence;
+    bool m_failed;
+};
+
+#endif//SPILL_RUNS_H
@@ -0,0 +1,171 @@
+#include "thread_pool.h"
+
+#include <chrono>
+#include <iterator>
+
+/* Which pool (and which of its queues) the current thread works for. */
+static thread_local const thread_pool *tls_pool = NULL;
+static thread_local unsigned int tls_queue = 0;
+
+thread_pool::thread_pool(unsigned int threads)
+  : m_queues(), m_workers(), m_queued(0), m_stopping(false), m_idle_lock(), m_idle()
+{
+  if(threads==0) threads = default_threads();
+  for(unsigned int i=0; i<threads; i++) {
+    m_queues.push_back(new queue());
+  }
+  /* queue 0 belongs to the creating thread */
+  tls_pool = this;
+  tls_queue = 0;
+  for(unsigned int i=1; i<threads; i++) {
+    m_workers.push_back(std::thread(&thread_pool::worker, this, i));
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> guard(m_idle_lock);
+    m_stopping = true;
+  }
+  m_idle.notify_all();
+  for(auto it=m_workers.begin(); it!=m_workers.end(); ++it) {
+    it->join();
+  }
+  for(auto it=m_queues.begin(); it!=m_queues.end(); ++it) {
+    delete *it;
+  }
+  if(tls_pool==this) tls_pool = NULL;
+}
+
+unsigned int thread_pool::default_threads() {
+  unsigned int threads = std::thread::hardware_concurrency();
+  return threads>0 ? threads : 1;
+}
+
+unsigned int thread_pool::current_queue() const {
+  return tls_pool==this ? tls_queue : 0;
+}
+
+void thread_pool::submit(std::function<void()> task, task_group *group) {
+  queue &q = *m_queues[current_queue()];
+  if(group!=NULL) group->m_queued++;
+  {
+    std::lock_guard<std::mutex> guard(q.lock);
+    queued_task next = { group, std::move(task) };
+    q.tasks.push_back(std::move(next));
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_idle_lock);
+    m_queued++;
+  }
+  m_idle.notify_one();
+}
+
+bool thread_pool::pop(unsigned int id, std::function<void()> &task) {
+  if(m_queued==0) return false;
+  /* LIFO from our own queue keeps the working set hot... */
+  {
+    queue &q = *m_queues[id];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if(!q.tasks.empty()) {
+      if(q.tasks.back().group!=NULL) q.tasks.back().group->m_queued--;
+      task = std::move(q.tasks.back().task);
+      q.tasks.pop_back();
+      m_queued--;
+      return true;
+    }
+  }
+  /* ...FIFO when stealing takes the oldest, usually largest, work */
+  for(unsigned int i=1; i<m_queues.size(); i++) {
+    queue &q = *m_queues[(id+i) % m_queues.size()];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if(!q.tasks.empty()) {
+      if(q.tasks.front().group!=NULL) q.tasks.front().group->m_queued--;
+      task = std::move(q.tasks.front().task);
+      q.tasks.pop_front();
+      m_queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * The newest of group's tasks, our own queue first. Those were queued
+ * lately, so the search from the back is short.
+ */
+bool thread_pool::pop_group(unsigned int id, task_group *group, std::function<void()> &task) {
+  for(unsigned int i=0; i<m_queues.size() && group->m_queued>0; i++) {
+    queue &q = *m_queues[(id+i) % m_queues.size()];
+    std::lock_guard<std::mutex> guard(q.lock);
+    for(auto it=q.tasks.rbegin(); it!=q.tasks.rend(); ++it) {
+      if(it->group!=group) continue;
+      group->m_queued--;
+      task = std::move(it->task);
+      q.tasks.erase(std::next(it).base());
+      m_queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool thread_pool::run_one(task_group *group) {
+  std::function<void()> task;
+  if(group!=NULL ? !pop_group(current_queue(), group, task) : !pop(current_queue(), task)) return false;
+  task();
+  return true;
+}
+
+void thread_pool::worker(unsigned int id) {
+  tls_pool = this;
+  tls_queue = id;
+  while(true) {
+    std::function<void()> task;
+    if(pop(id, task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(m_idle_lock);
+    m_idle.wait(guard, [this]() { return m_stopping || m_queued>0; });
+    if(m_stopping && m_queued==0) break;
+  }
+  tls_pool = NULL;
+}
+
+task_group::task_group(thread_pool &pool)
+  : m_pool(pool), m_pending(0), m_queued(0), m_lock(), m_done()
+{}
+
+task_group::~task_group() {
+  wait();
+}
+
+void task_group::run(std::function<void()> task) {
+  reserve();
+  run_reserved(std::move(task));
+}
+
+void task_group::reserve() {
+  m_pending++;
+}
+
+void task_group::run_reserved(std::function<void()> task) {
+  m_pool.submit([this, task]() {
+    task();
+    std::lock_guard<std::mutex> guard(m_lock);
+    if(--m_pending==0) m_done.notify_all();
+  }, this);
+}
+
+void task_group::wait() {
+  while(m_pending>0) {
+    if(m_pool.run_one(this)) continue;
+    /* Nothing of ours queued: the rest is in flight on other threads,
+     * or held back by the I/O queues until a read there finishes. */
+    std::unique_lock<std::mutex> guard(m_lock);
+    m_done.wait_for(guard, std::chrono::milliseconds(1), [this]() { return m_pending==0; });
+  }
+  /* the last task may still hold the lock it signalled us with */
+  std::lock_guard<std::mutex> guard(m_lock);
+}
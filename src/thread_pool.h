@@ -0,0 +1,94 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdlib>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class task_group;
+
+/*
+ * Work-stealing pool. Every worker owns a deque: it pushes and pops
+ * at the back, idle workers steal from the front of the others. The
+ * thread that created the pool takes part too, whilst it waits on a
+ * task_group, so a pool of N threads only spawns N-1 workers and a
+ * pool of 1 runs everything inline on the calling thread.
+ */
+class thread_pool {
+  public:
+    explicit thread_pool(unsigned int threads);
+    thread_pool(const thread_pool &)=delete;
+    thread_pool &operator=(const thread_pool &)=delete;
+    ~thread_pool();
+
+    unsigned int size() const {
+      return m_queues.size();
+    }
+
+    void submit(std::function<void()> task, task_group *group=NULL);
+    /* Run one queued task on the calling thread, only one of group's if
+     * given; false if none found. */
+    bool run_one(task_group *group=NULL);
+
+    static unsigned int default_threads();
+  protected:
+    struct queued_task {
+      task_group *group;
+      std::function<void()> task;
+    };
+    struct queue {
+      queue(): lock(), tasks() {}
+      std::mutex lock;
+      std::deque<queued_task> tasks;
+    };
+
+    void worker(unsigned int id);
+    bool pop(unsigned int id, std::function<void()> &task);
+    bool pop_group(unsigned int id, task_group *group, std::function<void()> &task);
+    unsigned int current_queue() const;
+
+    std::vector<queue *> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_queued;
+    std::atomic<bool> m_stopping;
+    std::mutex m_idle_lock;
+    std::condition_variable m_idle;
+};
+
+/*
+ * A set of tasks that can be waited on. wait() keeps executing this
+ * group's queued tasks until all of them have finished, so tasks may
+ * safely spawn and wait on nested groups. Tasks of other groups are
+ * left to their own waiters and idle workers: a waiting thread's stack
+ * only grows as deep as its groups nest, however many are queued.
+ */
+class task_group {
+  public:
+    explicit task_group(thread_pool &pool);
+    task_group(const task_group &)=delete;
+    task_group &operator=(const task_group &)=delete;
+    ~task_group();
+
+    void run(std::function<void()> task);
+    /* Count a task that will be passed to run_reserved() later, so
+     * that wait() waits for it as well. */
+    void reserve();
+    void run_reserved(std::function<void()> task);
+    void wait();
+  protected:
+    friend class thread_pool;
+
+    thread_pool &m_pool;
+    std::atomic<size_t> m_pending;
+    /* submitted to the pool, not yet taken off a queue */
+    std::atomic<size_t> m_queued;
+    std::mutex m_lock;
+    std::condition_variable m_done;
+};
+
+#endif//THREAD_POOL_H
@@ -0,0 +1,305 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "uring_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "crc_32.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__linux__)
+# include <linux/io_uring.h>
+# include <sys/syscall.h>
+# define URING_SUPPORTED
+#endif
+
+#ifdef URING_SUPPORTED
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Does the kernel know every opcode we need? */
+static bool probe_ops(int fd, bool &async_close) {
+  const size_t ops = 64;
+  size_t size = sizeof(struct io_uring_probe) + ops * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+  if(probe==NULL) return false;
+
+  bool ok = false;
+  if(sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, ops)==0) {
+    ok = probe->last_op>=IORING_OP_READ &&
+         (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+         (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    async_close = (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED)!=0;
+  }
+  free(probe);
+  return ok;
+}
+#endif
+
+uring_reader::uring_reader(unsigned int depth)
+  : m_fd(-1), m_depth(depth), m_to_submit(0), m_async_close(false)
+  , m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED), m_sq_ring_size(0), m_cq_ring_size(0)
+  , m_sqes(MAP_FAILED), m_sqes_size(0)
+  , m_sq_head(NULL), m_sq_tail(NULL), m_sq_mask(NULL), m_sq_array(NULL)
+  , m_cq_head(NULL), m_cq_tail(NULL), m_cq_mask(NULL), m_cqes(NULL)
+  , m_buffers(NULL), m_slots(), m_free()
+{
+#ifdef URING_SUPPORTED
+  if(m_depth==0) return;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = sys_io_uring_setup(m_depth, &params);
+  if(fd<0) return;
+  m_fd = fd;
+  m_depth = params.sq_entries;
+
+  m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if(params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+  }
+  m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if(params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_cq_ring = m_sq_ring;
+  } else {
+    m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+  }
+  m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+
+  if(m_sq_ring==MAP_FAILED || m_cq_ring==MAP_FAILED || m_sqes==MAP_FAILED || !probe_ops(m_fd, m_async_close)) {
+    release();
+    return;
+  }
+
+  unsigned char *sq = (unsigned char *)m_sq_ring;
+  unsigned char *cq = (unsigned char *)m_cq_ring;
+  m_sq_head = (unsigned *)(sq + params.sq_off.head);
+  m_sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  m_sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  m_sq_array = (unsigned *)(sq + params.sq_off.array);
+  m_cq_head = (unsigned *)(cq + params.cq_off.head);
+  m_cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  m_cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  m_cqes = cq + params.cq_off.cqes;
+
+  m_buffers = (unsigned char *)malloc((size_t)m_depth * URING_MAX_READ);
+  if(m_buffers==NULL) {
+    release();
+    return;
+  }
+  m_slots.resize(m_depth);
+  for(unsigned int i=0; i<m_depth; i++) {
+    m_slots[i].state = slot::IDLE;
+    m_slots[i].buffer = m_buffers + (size_t)i * URING_MAX_READ;
+    m_free.push_back(m_depth-1-i);
+  }
+#endif
+}
+
+uring_reader::~uring_reader() {
+  release();
+}
+
+void uring_reader::release() {
+  free(m_buffers);
+  m_buffers = NULL;
+  if(m_sqes!=MAP_FAILED) munmap(m_sqes, m_sqes_size);
+  if(m_cq_ring!=MAP_FAILED && m_cq_ring!=m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+  if(m_sq_ring!=MAP_FAILED) munmap(m_sq_ring, m_sq_ring_size);
+  m_sqes = m_cq_ring = m_sq_ring = MAP_FAILED;
+  if(m_fd>=0) close(m_fd);
+  m_fd = -1;
+}
+
+#ifdef URING_SUPPORTED
+void *uring_reader::get_sqe() {
+  /* At most one request per slot is in flight, so the ring never fills. */
+  unsigned tail = *m_sq_tail;
+  unsigned index = tail & *m_sq_mask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)m_sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  m_sq_array[index] = index;
+  __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  m_to_submit++;
+  return sqe;
+}
+
+void uring_reader::submit_open(slot &s, int flags) {
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)get_sqe();
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)s.job->path;
+  sqe->open_flags = flags;
+  sqe->user_data = &s - &m_slots[0];
+  s.open_flags = flags;
+  s.state = slot::OPENING;
+}
+
+void uring_reader::submit_read(slot &s) {
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)get_sqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = s.fd;
+  sqe->addr = (uint64_t)(uintptr_t)(s.buffer + s.done);
+  sqe->len = s.job->length - s.done;
+  sqe->off = s.done;
+  sqe->user_data = &s - &m_slots[0];
+  s.state = slot::READING;
+}
+
+void uring_reader::submit_close(slot &s) {
+  if(!m_async_close) {
+    close(s.fd);
+    s.state = slot::IDLE;
+    m_free.push_back(&s - &m_slots[0]);
+    return;
+  }
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)get_sqe();
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = s.fd;
+  sqe->user_data = &s - &m_slots[0];
+  s.state = slot::CLOSING;
+}
+
+void uring_reader::complete(slot &s, int result) {
+  switch(s.state) {
+    case slot::OPENING:
+      /* O_NOATIME is only for the owner: retry without, as shared_extents() does */
+      if(result==-EPERM && (s.open_flags & O_NOATIME)) {
+        submit_open(s, s.open_flags & ~O_NOATIME);
+        return;
+      }
+      if(result<0) {
+        s.state = slot::IDLE;
+        m_free.push_back(&s - &m_slots[0]);
+        return;
+      }
+      s.fd = result;
+      s.done = 0;
+      if(s.job->length==0) {
+        s.job->ok = true;
+        submit_close(s);
+      } else {
+        submit_read(s);
+      }
+      return;
+    case slot::READING:
+      if(result<=0) {
+        /* error, or the file shrank since it was scanned */
+        submit_close(s);
+        return;
+      }
+      s.done += result;
+      if(s.done<s.job->length) {
+        submit_read(s);
+        return;
+      }
+      s.job->crc = crc32(0, s.buffer, s.job->length);
+      s.job->ok = true;
+      submit_close(s);
+      return;
+    case slot::CLOSING:
+    default:
+      s.state = slot::IDLE;
+      m_free.push_back(&s - &m_slots[0]);
+      return;
+  }
+}
+
+/* Handle every completion posted; busy counts the slots still in use. */
+void uring_reader::reap(size_t &busy, bool draining) {
+  unsigned head = *m_cq_head;
+  unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+  for(; head!=tail; head++) {
+    struct io_uring_cqe *cqe = (struct io_uring_cqe *)m_cqes + (head & *m_cq_mask);
+    slot &s = m_slots[cqe->user_data];
+    if(draining) {
+      /* start nothing new, just close what is open */
+      if(s.state==slot::OPENING && cqe->res>=0) close(cqe->res);
+      if(s.state==slot::READING) close(s.fd);
+      s.state = slot::IDLE;
+      m_free.push_back(&s - &m_slots[0]);
+    } else {
+      complete(s, cqe->res);
+    }
+    if(s.state==slot::IDLE) busy--;
+  }
+  __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait out the requests still in flight, so that none is left to write
+ * into m_buffers or open a file after the ring is gone. False if the
+ * ring fails even for that.
+ */
+bool uring_reader::drain(size_t busy) {
+  while(busy>0) {
+    int r = sys_io_uring_enter(m_fd, m_to_submit, 1, IORING_ENTER_GETEVENTS);
+    if(r<0 && errno!=EINTR && errno!=EAGAIN && errno!=EBUSY) return false;
+    if(r>0) m_to_submit -= r;
+    reap(busy, true);
+  }
+  return true;
+}
+#endif
+
+void uring_reader::checksum(std::vector<checksum_job> &jobs) {
+#ifdef URING_SUPPORTED
+  if(m_fd<0) return;
+
+  size_t next = 0;
+  size_t busy = 0;
+  while(next<jobs.size() || busy>0) {
+    while(next<jobs.size() && !m_free.empty()) {
+      slot &s = m_slots[m_free.back()];
+      m_free.pop_back();
+      s.job = &jobs[next++];
+      s.job->ok = false;
+      if(s.job->length>URING_MAX_READ) {
+        /* not ours to read; leave ok unset for the caller */
+        m_free.push_back(&s - &m_slots[0]);
+        continue;
+      }
+      submit_open(s, O_RDONLY | O_CLOEXEC | O_NOATIME);
+      busy++;
+    }
+    /* the rest were all too large; waiting would never return */
+    if(busy==0) break;
+
+    int r = sys_io_uring_enter(m_fd, m_to_submit, 1, IORING_ENTER_GETEVENTS);
+    if(r<0 && errno!=EINTR && errno!=EAGAIN && errno!=EBUSY) {
+      /* the ring is unusable; callers fall back for unfinished jobs */
+      if(!drain(busy)) {
+        /* the kernel may still write to the buffers, so leave them be */
+        for(auto it=m_slots.begin(); it!=m_slots.end(); ++it) {
+          if(it->state==slot::READING) close(it->fd);
+        }
+        m_buffers = NULL;
+      }
+      release();
+      return;
+    }
+    if(r>0) m_to_submit -= r;
+    reap(busy, false);
+  }
+#else
+  (void)jobs;
+#endif
+}
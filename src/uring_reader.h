@@ -0,0 +1,88 @@
+#ifndef URING_READER_H
+#define URING_READER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+/* Reads larger than this are left to the file_reader backends. */
+#define URING_MAX_READ (size_t)(64*1024)
+
+struct checksum_job {
+  checksum_job(const char *_path, size_t _length)
+    : path(_path), length(_length), crc(0), ok(false)
+  {}
+
+  const char *path;
+  size_t length;     /* bytes to checksum, at most URING_MAX_READ */
+  uint32_t crc;
+  bool ok;
+};
+
+/*
+ * Checksums the head of many small files through io_uring, keeping up
+ * to depth open/read/close requests in flight at once. Per-file latency
+ * rather than bandwidth dominates small files on a cold cache, and this
+ * overlaps it without a thread per request. Talks to the kernel
+ * directly, so liburing is not needed.
+ */
+class uring_reader {
+  public:
+    explicit uring_reader(unsigned int depth);
+    uring_reader(const uring_reader &)=delete;
+    uring_reader &operator=(const uring_reader &)=delete;
+    ~uring_reader();
+
+    /* False if the kernel lacks io_uring or the needed operations. */
+    bool available() const {
+      return m_fd>=0;
+    }
+
+    /* Fill in crc and ok for every job. */
+    void checksum(std::vector<checksum_job> &jobs);
+  protected:
+    struct slot {
+      enum { IDLE, OPENING, READING, CLOSING } state;
+      checksum_job *job;
+      int open_flags;
+      int fd;
+      size_t done;
+      unsigned char *buffer;
+    };
+
+    void release();
+    void *get_sqe();
+    void submit_open(slot &s, int flags);
+    void submit_read(slot &s);
+    void submit_close(slot &s);
+    void complete(slot &s, int result);
+    void reap(size_t &busy, bool draining);
+    bool drain(size_t busy);
+
+    int m_fd;
+    unsigned int m_depth;
+    unsigned int m_to_submit;
+    bool m_async_close;
+
+    void *m_sq_ring;
+    void *m_cq_ring;
+    size_t m_sq_ring_size;
+    size_t m_cq_ring_size;
+    void *m_sqes;
+    size_t m_sqes_size;
+
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    void *m_cqes;
+
+    unsigned char *m_buffers;
+    std::vector<slot> m_slots;
+    std::vector<unsigned int> m_free;
+};
+
+#endif//URING_READER_H